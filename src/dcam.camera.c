@@ -3,6 +3,7 @@
 #include "device/props/metadata.h"
 #include "logger.h"
 
+#include "dcam.copy.h"
 #include "dcam.error.h"
 #include "dcam.getset.h"
 #include "dcam.prelude.h"
@@ -14,14 +15,13 @@
 #include <dcamprop.h>
 
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
 #define countof(e) (sizeof(e) / sizeof((e)[0]))
 #define containerof(P, T, F) ((T*)(((char*)(P)) - offsetof(T, F)))
 
-#define MAX_CAMERAS (countof(((struct Dcam4Driver*)(0))->cameras))
-
 //
 // These define the logical index of these digital lines
 //
@@ -31,6 +31,19 @@
 #define LINE_TIMING3 3
 #define LINE_SOFTWARE 4
 
+// Longest the capture thread waits on the camera before checking whether
+// it's been asked to stop.
+#define CAPTURE_THREAD_WAIT_MS 100
+
+// How often the capture thread checks a full queue for a free slot.
+#define QUEUE_POLL_MS 0.5
+
+// The trigger thread sleeps until this long before each trigger, then spins,
+// since sleeps can overshoot by a scheduler quantum. It wakes at least every
+// TRIGGER_POLL_MS to check whether it's been asked to stop.
+#define TRIGGER_SPIN_MS 2.0
+#define TRIGGER_POLL_MS 10.0
+
 //
 // HDCAM Property accessors
 //
@@ -58,22 +71,35 @@
 //
 // Forward declarations
 //
-struct Dcam4Camera*
-reset_driver_and_replace_camera(struct Dcam4Camera* self);
+int
+aq_dcam_recover(struct Dcam4Camera* self, int may_reopen);
 
-struct image_descriptor
+/// Whether SampleType_u8 should be converted by the driver from 16-bit
+/// pixels sent by the camera.
+static int
+wants_u8_from_u16(const struct Dcam4Camera* self)
 {
-    DCAM_PIXELTYPE pixel_type;
-    int32_t offset, pitch, width, height;
-};
+    return self->options.u8_source != Dcam4U8Source_Camera;
+}
 
 static int
-set_sample_type(HDCAM hdcam, enum SampleType* value)
+set_sample_type(struct Dcam4Camera* self, enum SampleType* value)
 {
+    HDCAM hdcam = self->hdcam;
+    const int is_u8_from_u16 =
+      *value == SampleType_u8 && wants_u8_from_u16(self);
     double v;
+    self->is_u8_from_u16 = 0;
     switch (*value) {
         case SampleType_u8:
-            v = DCAM_PIXELTYPE_MONO8;
+            v = is_u8_from_u16 ? DCAM_PIXELTYPE_MONO16 : DCAM_PIXELTYPE_MONO8;
+            break;
+        case SampleType_u12:
+            // Prefer the packed format: it's a quarter smaller on the wire.
+            v = DCAM_PIXELTYPE_MONO12P;
+            if (DISFAIL(DCALL(
+                  dcamprop_setvalue(hdcam, DCAM_IDPROP_IMAGE_PIXELTYPE, v))))
+                v = DCAM_PIXELTYPE_MONO12;
             break;
         case SampleType_u16:
             v = DCAM_PIXELTYPE_MONO16;
@@ -87,8 +113,13 @@ set_sample_type(HDCAM hdcam, enum SampleType* value)
         case DCAM_PIXELTYPE_MONO8:
             *value = SampleType_u8;
             break;
+        case DCAM_PIXELTYPE_MONO12:
+        case DCAM_PIXELTYPE_MONO12P:
+            *value = SampleType_u12;
+            break;
         case DCAM_PIXELTYPE_MONO16:
-            *value = SampleType_u16;
+            self->is_u8_from_u16 = is_u8_from_u16;
+            *value = is_u8_from_u16 ? SampleType_u8 : SampleType_u16;
             break;
         default:
             *value = SampleType_Unknown;
@@ -112,6 +143,75 @@ get_image_description(HDCAM h, struct image_descriptor* desc)
     return is_ok;
 }
 
+/// The frame geometry snapshot taken by aq_dcam_start(), or a fresh read
+/// from the camera when capture isn't running.
+static int
+get_image_description__cached(struct Dcam4Camera* self,
+                              struct image_descriptor* desc)
+{
+    if (self->is_desc_valid) {
+        *desc = self->desc;
+        return 1;
+    }
+    return get_image_description(self->hdcam, desc);
+}
+
+/// Bytes of pixel data in a row of a frame in the DCAM ring, not counting
+/// the row padding.
+static size_t
+bytes_of_packed_row(const struct image_descriptor* desc)
+{
+    switch (desc->pixel_type) {
+        case DCAM_PIXELTYPE_MONO8:
+            return desc->width;
+        case DCAM_PIXELTYPE_MONO12P:
+            return (3 * (size_t)desc->width + 1) / 2;
+        default:
+            return 2 * (size_t)desc->width;
+    }
+}
+
+/// Whether frames in the ring are packed 12-bit pixels that get_frame()
+/// unpacks to 16 bits.
+static int
+is_unpacking_mono12p(const struct Dcam4Camera* self,
+                     const struct image_descriptor* desc)
+{
+    return desc->pixel_type == DCAM_PIXELTYPE_MONO12P &&
+           !self->options.pass_through_mono12p;
+}
+
+/// Whether get_frame() converts 16-bit frames in the ring to 8 bits.
+static int
+is_converting_to_u8(const struct Dcam4Camera* self,
+                    const struct image_descriptor* desc)
+{
+    return self->is_u8_from_u16 && desc->pixel_type == DCAM_PIXELTYPE_MONO16;
+}
+
+/// Whether get_frame() bins or decimates frames in software.
+static int
+is_binning(const struct Dcam4Camera* self, const struct image_descriptor* desc)
+{
+    const struct Dcam4Options* o = &self->options;
+    if (desc->pixel_type == DCAM_PIXELTYPE_MONO12P && o->pass_through_mono12p)
+        return 0;
+    return o->sw_bin_x > 1 || o->sw_bin_y > 1 || o->sw_decimate_x > 1 ||
+           o->sw_decimate_y > 1;
+}
+
+static struct binning
+to_binning(const struct Dcam4Options* o)
+{
+    return (struct binning){
+        .bin_x = o->sw_bin_x,
+        .bin_y = o->sw_bin_y,
+        .step_x = o->sw_decimate_x,
+        .step_y = o->sw_decimate_y,
+        .is_mean = o->sw_bin_mode == Dcam4BinMode_Mean,
+    };
+}
+
 static enum SampleType
 to_sample_type(DCAM_PIXELTYPE p)
 {
@@ -120,11 +220,12 @@ to_sample_type(DCAM_PIXELTYPE p)
             return SampleType_u8;
         case DCAM_PIXELTYPE_MONO16:
             return SampleType_u16;
+        case DCAM_PIXELTYPE_MONO12:
+        case DCAM_PIXELTYPE_MONO12P:
+            return SampleType_u12;
 
             // The following are unsupported
 
-        case DCAM_PIXELTYPE_MONO12:
-        case DCAM_PIXELTYPE_MONO12P:
         case DCAM_PIXELTYPE_RGB24:
         case DCAM_PIXELTYPE_RGB48:
         case DCAM_PIXELTYPE_BGR24:
@@ -135,6 +236,86 @@ to_sample_type(DCAM_PIXELTYPE p)
     }
 }
 
+static void
+set_shape_dims(struct ImageShape* shape, uint32_t width, uint32_t height)
+{
+    shape->dims.width = width;
+    shape->dims.height = height;
+    shape->strides.height = width;
+    shape->strides.planes = width * height;
+}
+
+/// Describes frames with `desc`'s geometry. Packed 12-bit frames that are
+/// not `unpacked` are described as rows of bytes.
+static void
+to_image_shape(const struct image_descriptor* desc,
+               int unpacked,
+               struct ImageShape* shape)
+{
+    memset(shape, 0, sizeof(*shape));
+    *shape = (struct ImageShape){
+        .dims = { .channels = 1, .planes = 1 },
+        .strides = { .channels = 1, .width = 1 },
+        .type = to_sample_type(desc->pixel_type),
+    };
+    set_shape_dims(shape, desc->width, desc->height);
+    if (desc->pixel_type == DCAM_PIXELTYPE_MONO12P && !unpacked) {
+        shape->type = SampleType_u8;
+        set_shape_dims(
+          shape, (uint32_t)bytes_of_packed_row(desc), desc->height);
+    }
+}
+
+/// Describes frames delivered by get_frame(), after the driver's processing
+/// stages.
+static void
+to_delivered_shape(const struct Dcam4Camera* self,
+                   const struct image_descriptor* desc,
+                   struct ImageShape* shape)
+{
+    to_image_shape(desc, is_unpacking_mono12p(self, desc), shape);
+    if (is_binning(self, desc)) {
+        const struct Dcam4Options* o = &self->options;
+        set_shape_dims(
+          shape,
+          (uint32_t)binned_size(desc->width, o->sw_bin_x, o->sw_decimate_x),
+          (uint32_t)binned_size(desc->height, o->sw_bin_y, o->sw_decimate_y));
+    }
+    if (is_converting_to_u8(self, desc))
+        shape->type = SampleType_u8;
+}
+
+static size_t
+bytes_of_shape(const struct ImageShape* shape)
+{
+    const size_t bytes_per_pixel = shape->type == SampleType_u8 ? 1 : 2;
+    return bytes_per_pixel * shape->strides.planes;
+}
+
+/// Header of each slot in the capture thread's queue. The frame follows it,
+/// packed as get_frame() delivers it.
+struct queued_frame
+{
+    size_t nbytes;
+    struct ImageInfo info;
+    uint32_t gap; // frames dropped just before this one
+};
+
+static size_t
+bytes_of_queued_frame_header(void)
+{
+    // Keep the frame aligned to a cache line.
+    return (sizeof(struct queued_frame) + 63) & ~(size_t)63;
+}
+
+static void
+to_image_info(const DCAMBUF_FRAME* frame, struct ImageInfo* info)
+{
+    info->hardware_frame_id = (uint64_t)frame->framestamp;
+    info->hardware_timestamp = (uint64_t)(1e6 * frame->timestamp.sec) +
+                               (uint64_t)frame->timestamp.microsec;
+}
+
 static enum TriggerEdge
 to_trigger_edge(uint64_t p)
 {
@@ -149,13 +330,16 @@ to_trigger_edge(uint64_t p)
 }
 
 static int
-set_readout_speed(HDCAM h)
+set_readout_speed(struct Dcam4Camera* self)
 {
+    HDCAM h = self->hdcam;
+    self->sensor_mode = 0;
     DCAM(dcamprop_setvalue(
       h, DCAM_IDPROP_READOUTSPEED, DCAMPROP_READOUTSPEED__FASTEST));
     DCAM(dcamprop_setvalue(h,
                            DCAM_IDPROP_SENSORMODE,
                            DCAMPROP_SENSORMODE__PROGRESSIVE)); // lightsheet
+    self->sensor_mode = DCAMPROP_SENSORMODE__PROGRESSIVE;
     return 1;
 Error:
     return 0;
@@ -176,26 +360,32 @@ select_trigger(struct CameraProperties* settings)
 }
 
 static int
-disable_external_triggering(HDCAM h)
+disable_external_triggering(HDCAM h, int32_t* trigger_source)
 {
     DCAM(dcamprop_setvalue(
       h, DCAM_IDPROP_TRIGGER_MODE, DCAMPROP_TRIGGER_MODE__NORMAL));
     DCAM(dcamprop_setvalue(
       h, DCAM_IDPROP_TRIGGERSOURCE, DCAMPROP_TRIGGERSOURCE__INTERNAL));
+    *trigger_source = DCAMPROP_TRIGGERSOURCE__INTERNAL;
     return 1;
 Error:
     return 0;
 }
 
+/// Also keeps `trigger_source` in step with DCAM_IDPROP_TRIGGERSOURCE. It's
+/// set to 0 if the source is left unknown.
 static int
-set_input_triggering(HDCAM h, struct CameraProperties* settings)
+set_input_triggering(HDCAM h,
+                     struct CameraProperties* settings,
+                     int32_t* trigger_source)
 {
     int use_software_trigger = 0;
+    *trigger_source = 0;
     {
         struct Trigger* event = select_trigger(settings);
         if (!event) {
             // None are enabled
-            CHECK(disable_external_triggering(h));
+            CHECK(disable_external_triggering(h, trigger_source));
         } else {
             use_software_trigger = (event->line == LINE_SOFTWARE);
             CHECK(event->kind == Signal_Input);
@@ -225,11 +415,11 @@ set_input_triggering(HDCAM h, struct CameraProperties* settings)
                                   ? DCAMPROP_TRIGGERENABLE_POLARITY__NEGATIVE
                                   : DCAMPROP_TRIGGERENABLE_POLARITY__POSITIVE));
 
-            DCAM(dcamprop_setvalue(h,
-                                   DCAM_IDPROP_TRIGGERSOURCE,
-                                   use_software_trigger
+            const int32_t source = use_software_trigger
                                      ? DCAMPROP_TRIGGERSOURCE__SOFTWARE
-                                     : DCAMPROP_TRIGGERSOURCE__EXTERNAL));
+                                     : DCAMPROP_TRIGGERSOURCE__EXTERNAL;
+            DCAM(dcamprop_setvalue(h, DCAM_IDPROP_TRIGGERSOURCE, source));
+            *trigger_source = source;
         }
     }
 
@@ -344,9 +534,48 @@ Error:
     return 0;
 }
 
-int
-aq_dcam_get_metadata__inner(const struct Dcam4Camera* self,
-                            struct CameraPropertyMetadata* metadata)
+/// Sets binning on the camera. Independent horizontal and vertical binning
+/// from the options takes precedence over CameraProperties::binning.
+static int
+set_binning(struct Dcam4Camera* self, struct CameraProperties* props)
+{
+    HDCAM hdcam = self->hdcam;
+    const struct Dcam4Options* o = &self->options;
+    // Whether independent binning is known to be off already.
+    const int was_uniform = self->status.binning.horizontal &&
+                            !self->requested_binning.horz &&
+                            !self->requested_binning.vert;
+    self->requested_binning.horz = o->binning_horz;
+    self->requested_binning.vert = o->binning_vert;
+    if (o->binning_horz || o->binning_vert) {
+        int32_t h = o->binning_horz ? o->binning_horz : 1;
+        int32_t v = o->binning_vert ? o->binning_vert : 1;
+        DCAM(dcamprop_setvalue(
+          hdcam, DCAM_IDPROP_BINNING_INDEPENDENT, DCAMPROP_MODE__ON));
+        CHECK(prop_write(i32, hdcam, DCAM_IDPROP_BINNING_HORZ, &h));
+        CHECK(prop_write(i32, hdcam, DCAM_IDPROP_BINNING_VERT, &v));
+        self->status.binning.horizontal = (uint8_t)h;
+        self->status.binning.vertical = (uint8_t)v;
+    } else {
+        // Cameras without independent binning reject this, which is fine.
+        if (!was_uniform)
+            DCALL(dcamprop_setvalue(
+              hdcam, DCAM_IDPROP_BINNING_INDEPENDENT, DCAMPROP_MODE__OFF));
+        int32_t v = props->binning;
+        CHECK(prop_write(i32, hdcam, DCAM_IDPROP_BINNING, &v));
+        props->binning = (uint8_t)v;
+        self->status.binning.horizontal = (uint8_t)v;
+        self->status.binning.vertical = (uint8_t)v;
+    }
+    return 1;
+Error:
+    return 0;
+}
+
+/// Reads capability ranges from the camera.
+static int
+read_metadata(const struct Dcam4Camera* self,
+              struct CameraPropertyMetadata* metadata)
 {
     int is_ok = 1;
 
@@ -378,7 +607,7 @@ aq_dcam_get_metadata__inner(const struct Dcam4Camera* self,
 #undef READ_PROP_META
 
     metadata->supported_pixel_types =
-      (1 << SampleType_u8) | (1 << SampleType_u16);
+      (1 << SampleType_u8) | (1 << SampleType_u12) | (1 << SampleType_u16);
 
     // Triggering
     // Names for trigger lines are taken from Orca Fusion manual
@@ -401,6 +630,53 @@ aq_dcam_get_metadata__inner(const struct Dcam4Camera* self,
     return is_ok;
 }
 
+/// Answers from the cached capabilities, reading them from the camera only
+/// if something they depend on changed since they were last read.
+/// Must be called with the camera lock held.
+int
+aq_dcam_get_metadata__inner(struct Dcam4Camera* self,
+                            struct CameraPropertyMetadata* metadata)
+{
+    if (self->is_metadata_valid) {
+        *metadata = self->metadata;
+        return 1;
+    }
+    const int is_ok = read_metadata(self, metadata);
+    if (is_ok)
+        self->metadata = *metadata;
+    self->is_metadata_valid = is_ok;
+    return is_ok;
+}
+
+enum DeviceStatusCode
+aq_dcam_get_binning_metadata(const struct Camera* self_,
+                             struct Dcam4BinningMetadata* meta)
+{
+    struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
+    lock_acquire(&self->lock);
+    memset(meta, 0, sizeof(*meta));
+    DCAMPROP_ATTR attr = { .cbSize = sizeof(attr),
+                           .iProp = DCAM_IDPROP_BINNING_INDEPENDENT };
+    if (!DISFAIL(DCALL(dcamprop_getattr(self->hdcam, &attr)))) {
+        meta->is_independent_supported = 1;
+        CHECK(read_prop_capabilities_(&meta->horizontal,
+                                      self->hdcam,
+                                      DCAM_IDPROP_BINNING_HORZ,
+                                      1.0f,
+                                      "DCAM_IDPROP_BINNING_HORZ"));
+        CHECK(read_prop_capabilities_(&meta->vertical,
+                                      self->hdcam,
+                                      DCAM_IDPROP_BINNING_VERT,
+                                      1.0f,
+                                      "DCAM_IDPROP_BINNING_VERT"));
+    }
+    lock_release(&self->lock);
+    return Device_Ok;
+Error:
+    lock_release(&self->lock);
+    return Device_Err;
+}
+
 enum DeviceStatusCode
 aq_dcam_get_metadata(const struct Camera* self_,
                      struct CameraPropertyMetadata* metadata)
@@ -443,126 +719,310 @@ clamp_float(float* v, float low, float high)
         *v = high;
 }
 
-enum DeviceStatusCode
-aq_dcam_set__inner(struct Dcam4Camera* self,
-                   struct CameraProperties* props,
-                   int force)
+/// Groups of properties aq_dcam_set__inner() writes together, in the order
+/// they're written. What's valid for a stage can depend on the stages before
+/// it.
+enum config_stage
 {
-    HDCAM hdcam = self->hdcam;
+    Config_SensorMode = 1 << 0, // and readout speed
+    Config_PixelType = 1 << 1,
+    Config_ReadoutDirection = 1 << 2,
+    Config_Binning = 1 << 3,
+    Config_Roi = 1 << 4,
+    Config_LineInterval = 1 << 5,
+    Config_Exposure = 1 << 6,
+    Config_InputTriggers = 1 << 7,
+    Config_OutputTriggers = 1 << 8,
+};
 
-    {
-        struct CameraPropertyMetadata metadata;
-        aq_dcam_get_metadata__inner(self, &metadata);
-#define CLAMP(type, field)                                                     \
-    clamp_##type(&props->field, metadata.field.low, metadata.field.high);
-        CLAMP(uint8_t, binning);
-#undef CLAMP
+/// Stages that limit the capability ranges of the stages after them.
+#define CONFIG_CONSTRAINING                                                    \
+    (Config_SensorMode | Config_PixelType | Config_ReadoutDirection |         \
+     Config_Binning)
+
+/// Stages the camera may adjust to suit a new value for `stage`. They're
+/// written again after it, even if their requested values didn't change.
+static uint32_t
+config_dependents(enum config_stage stage)
+{
+    switch (stage) {
+        case Config_SensorMode:
+            return Config_Binning | Config_Roi | Config_LineInterval |
+                   Config_Exposure;
+        case Config_PixelType:
+        case Config_ReadoutDirection:
+            return Config_LineInterval | Config_Exposure;
+        case Config_Binning:
+            return Config_Roi | Config_LineInterval | Config_Exposure;
+        case Config_LineInterval:
+            return Config_Exposure;
+        default:
+            return 0;
     }
+}
 
-#define IS_CHANGED(prop) (force || (self->last_props.prop != props->prop))
+/// Stages whose requested values differ from the ones last written.
+static uint32_t
+config_diff(const struct Dcam4Camera* self,
+            const struct CameraProperties* props,
+            int force)
+{
+    const struct CameraProperties* last = &self->last_props;
+    uint32_t dirty = 0;
+    if (force)
+        return ~(uint32_t)0;
+    if (self->sensor_mode != DCAMPROP_SENSORMODE__PROGRESSIVE)
+        dirty |= Config_SensorMode;
+    if (props->pixel_type != last->pixel_type ||
+        (props->pixel_type == SampleType_u8 &&
+         self->is_u8_from_u16 != wants_u8_from_u16(self)))
+        dirty |= Config_PixelType;
+    if (props->readout_direction != last->readout_direction)
+        dirty |= Config_ReadoutDirection;
+    if (props->binning != last->binning ||
+        self->requested_binning.horz != self->options.binning_horz ||
+        self->requested_binning.vert != self->options.binning_vert)
+        dirty |= Config_Binning;
+    if (props->offset.x != last->offset.x ||
+        props->offset.y != last->offset.y ||
+        props->shape.x != last->shape.x || props->shape.y != last->shape.y)
+        dirty |= Config_Roi;
+    if (props->line_interval_us != last->line_interval_us)
+        dirty |= Config_LineInterval;
+    if (props->exposure_time_us != last->exposure_time_us)
+        dirty |= Config_Exposure;
+    if (memcmp(&props->input_triggers,
+               &last->input_triggers,
+               sizeof(props->input_triggers)) != 0)
+        dirty |= Config_InputTriggers;
+    if (memcmp(&props->output_triggers,
+               &last->output_triggers,
+               sizeof(props->output_triggers)) != 0)
+        dirty |= Config_OutputTriggers;
+    return dirty;
+}
 
-    int is_ok = 1;
+static int
+set_readout_direction(HDCAM hdcam, enum Direction direction)
+{
+    double value = 0;
+    switch (direction) {
+        case Direction_Backward:
+            value = DCAMPROP_READOUT_DIRECTION__BACKWARD;
+            break;
+        case Direction_Forward:
+            value = DCAMPROP_READOUT_DIRECTION__FORWARD;
+            break;
+        default:
+            ERR("Unrecognized readout direction value (%d). Using "
+                "FORWARD.",
+                direction);
+            value = DCAMPROP_READOUT_DIRECTION__FORWARD;
+    }
+    DCALL(dcamprop_setvalue(hdcam, DCAM_IDPROP_READOUT_DIRECTION, value));
+    return 1;
+}
 
-    // Set readout speed and mode.
-    // It's important to do this first as it effects what settings are valid
-    // for downstream parameters (e.g. subarray, and exposure)
-    is_ok &= set_readout_speed(hdcam);
+/// Moves and resizes the subarray along one axis. The camera refuses a
+/// subarray that runs off the sensor, so the writes are ordered to keep it
+/// on. When `is_known` is set, `last_pos` and `last_size` are what the camera
+/// has now and unchanged values aren't written.
+static int
+set_subarray_axis(HDCAM h,
+                  int32_t pos_id,
+                  int32_t size_id,
+                  const char* name,
+                  int is_known,
+                  uint32_t last_pos,
+                  uint32_t last_size,
+                  uint32_t* pos,
+                  uint32_t* size,
+                  uint32_t extent)
+{
+    int is_pos_changed = !is_known || *pos != last_pos;
+    const int is_size_changed = !is_known || *size != last_size;
+    uint32_t zero = 0;
 
-    // pixel type
-    if (IS_CHANGED(pixel_type)) {
-        is_ok &= set_sample_type(hdcam, &props->pixel_type);
+    if (!is_known) {
+        CHECK(prop_write_u32(h, pos_id, &zero, name));
+        last_pos = 0;
     }
-
-    // binning
-    if (IS_CHANGED(binning)) {
-        dcamprop_setvalue(
-          hdcam, DCAM_IDPROP_BINNING_INDEPENDENT, DCAMPROP_MODE__OFF);
-        int32_t v = props->binning;
-        is_ok &= prop_write(i32, hdcam, DCAM_IDPROP_BINNING, &v);
-        props->binning = (uint8_t)v;
+    if (is_size_changed) {
+        if (last_pos + *size > extent) {
+            if (is_pos_changed && *pos + last_size <= extent) {
+                // The new size fits once it's moved.
+                CHECK(prop_write_u32(h, pos_id, pos, name));
+                is_pos_changed = 0;
+            } else {
+                CHECK(prop_write_u32(h, pos_id, &zero, name));
+                is_pos_changed = *pos != 0;
+            }
+        }
+        CHECK(prop_write_u32(h, size_id, size, name));
     }
+    if (is_pos_changed)
+        CHECK(prop_write_u32(h, pos_id, pos, name));
+    return 1;
+Error:
+    return 0;
+}
 
-    // readout direction
-    if (IS_CHANGED(readout_direction)) {
-        double value = 0;
-        switch (props->readout_direction) {
-            case Direction_Backward:
-                value = DCAMPROP_READOUT_DIRECTION__BACKWARD;
-                break;
-            case Direction_Forward:
-                value = DCAMPROP_READOUT_DIRECTION__FORWARD;
-                break;
-            default:
-                ERR("Unrecognized readout direction value (%d). Using "
-                    "FORWARD.",
-                    props->readout_direction);
-                value = DCAMPROP_READOUT_DIRECTION__FORWARD;
-        }
-        dcamprop_setvalue(hdcam, DCAM_IDPROP_READOUT_DIRECTION, value);
+/// @param is_known Whether last_props has the camera's current subarray.
+static int
+set_roi(struct Dcam4Camera* self,
+        struct CameraProperties* props,
+        const struct CameraPropertyMetadata* metadata,
+        int is_known)
+{
+    const struct CameraProperties* last = &self->last_props;
+    if (!is_known || !self->is_subarray_mode_on) {
+        DCAM(dcamprop_setvalue(
+          self->hdcam, DCAM_IDPROP_SUBARRAYMODE, DCAMPROP_MODE__ON));
+        self->is_subarray_mode_on = 1;
     }
+    CHECK(set_subarray_axis(self->hdcam,
+                            DCAM_IDPROP_SUBARRAYHPOS,
+                            DCAM_IDPROP_SUBARRAYHSIZE,
+                            "DCAM_IDPROP_SUBARRAYH",
+                            is_known,
+                            last->offset.x,
+                            last->shape.x,
+                            &props->offset.x,
+                            &props->shape.x,
+                            (uint32_t)metadata->shape.x.high));
+    CHECK(set_subarray_axis(self->hdcam,
+                            DCAM_IDPROP_SUBARRAYVPOS,
+                            DCAM_IDPROP_SUBARRAYVSIZE,
+                            "DCAM_IDPROP_SUBARRAYV",
+                            is_known,
+                            last->offset.y,
+                            last->shape.y,
+                            &props->offset.y,
+                            &props->shape.y,
+                            (uint32_t)metadata->shape.y.high));
+    return 1;
+Error:
+    self->is_subarray_mode_on = 0;
+    return 0;
+}
 
-    {
-        // Binning changes a bunch of stuff so re-read the capabilities
-        struct CameraPropertyMetadata metadata;
-        aq_dcam_get_metadata__inner(self, &metadata);
+static enum DeviceStatusCode
+read_properties__locked(struct Dcam4Camera* self,
+                        struct CameraProperties* props);
+
+int
+aq_dcam_release_ring__inner(struct Dcam4Camera* self);
+
+/// Releases the ring before a stage that changes the frame layout. Fails
+/// while capture is running, since DCAM is still writing to the ring.
+static int
+prepare_layout_change__inner(struct Dcam4Camera* self)
+{
+    EXPECT(!self->is_desc_valid,
+           "Can't change the frame layout while capture is running.");
+    return aq_dcam_release_ring__inner(self);
+Error:
+    return 0;
+}
+
+/// Writes only the properties that changed, and the ones the camera may have
+/// adjusted to suit them, in dependency order. See enum config_stage.
+enum DeviceStatusCode
+aq_dcam_set__inner(struct Dcam4Camera* self,
+                   struct CameraProperties* props,
+                   int force)
+{
+    HDCAM hdcam = self->hdcam;
+    const uint64_t calls_before = dcam_call_count;
+    struct CameraPropertyMetadata metadata;
+    int is_ok = 1;
+    // Stages with new values, and stages written because one they depend on
+    // was.
+    uint32_t changed = config_diff(self, props, force);
+    uint32_t adjusted = 0;
+
+    // DCAM won't change the frame layout while a ring is allocated, so a ring
+    // kept from the last capture is released before those stages. Other
+    // stages may change while capture runs.
+#define WRITE_STAGE(stage, e)                                                  \
+    do {                                                                       \
+        if ((changed | adjusted) & (stage)) {                                  \
+            if (((stage) & (CONFIG_CONSTRAINING | Config_Roi)) &&              \
+                !prepare_layout_change__inner(self))                           \
+                is_ok = 0;                                                     \
+            else                                                               \
+                is_ok &= (e);                                                  \
+            adjusted |= config_dependents(stage);                              \
+            if ((stage)&CONFIG_CONSTRAINING)                                   \
+                self->is_metadata_valid = 0;                                   \
+        }                                                                      \
+    } while (0)
 #define CLAMP(type, field)                                                     \
     clamp_##type(&props->field, metadata.field.low, metadata.field.high);
-        CLAMP(uint32_t, offset.x);
-        CLAMP(uint32_t, offset.y);
-        CLAMP(uint32_t, shape.x);
-        CLAMP(uint32_t, shape.y);
-        CLAMP(float, exposure_time_us);
-        CLAMP(float, line_interval_us);
-#undef CLAMP
-    }
 
-    // roi
-    if (IS_CHANGED(offset.x) || IS_CHANGED(offset.y) || IS_CHANGED(shape.x) ||
-        IS_CHANGED(shape.y)) {
-        is_ok &= (dcamprop_setvalue(hdcam,
-                                    DCAM_IDPROP_SUBARRAYMODE,
-                                    DCAMPROP_MODE__ON) == DCAMERR_SUCCESS);
-
-        // temporarily set offset to (0,0) so we're free to change the shape
-        is_ok &= dcamprop_setvalue(hdcam, DCAM_IDPROP_SUBARRAYVPOS, 0.0f) ==
-                 DCAMERR_SUCCESS;
-        is_ok &= dcamprop_setvalue(hdcam, DCAM_IDPROP_SUBARRAYHPOS, 0.0f) ==
-                 DCAMERR_SUCCESS;
-
-        is_ok &=
-          prop_write(u32, hdcam, DCAM_IDPROP_SUBARRAYHSIZE, &props->shape.x);
-        is_ok &=
-          prop_write(u32, hdcam, DCAM_IDPROP_SUBARRAYVSIZE, &props->shape.y);
-
-        is_ok &=
-          prop_write(u32, hdcam, DCAM_IDPROP_SUBARRAYVPOS, &props->offset.y);
-        is_ok &=
-          prop_write(u32, hdcam, DCAM_IDPROP_SUBARRAYHPOS, &props->offset.x);
-    }
-
-    // exposure
-    if (IS_CHANGED(exposure_time_us) || IS_CHANGED(line_interval_us)) {
-        is_ok &= prop_write_scaled(f32,
-                                   hdcam,
-                                   DCAM_IDPROP_INTERNAL_LINEINTERVAL,
-                                   1e-6f,
-                                   &props->line_interval_us);
-        is_ok &= prop_write_scaled(f32,
-                                   hdcam,
-                                   DCAM_IDPROP_EXPOSURETIME,
-                                   1e-6f,
-                                   &props->exposure_time_us);
-    }
-#undef IS_CHANGED
+    // Set readout speed and mode.
+    // It's important to do this first as it effects what settings are valid
+    // for downstream parameters (e.g. subarray, and exposure)
+    WRITE_STAGE(Config_SensorMode, set_readout_speed(self));
+
+    aq_dcam_get_metadata__inner(self, &metadata);
+    CLAMP(uint8_t, binning);
+    changed |= config_diff(self, props, force);
+
+    WRITE_STAGE(Config_PixelType, set_sample_type(self, &props->pixel_type));
+    WRITE_STAGE(Config_ReadoutDirection,
+                set_readout_direction(hdcam, props->readout_direction));
+    WRITE_STAGE(Config_Binning, set_binning(self, props));
+
+    // Binning changes a bunch of stuff, so this may re-read the
+    // capabilities.
+    aq_dcam_get_metadata__inner(self, &metadata);
+    CLAMP(uint32_t, offset.x);
+    CLAMP(uint32_t, offset.y);
+    CLAMP(uint32_t, shape.x);
+    CLAMP(uint32_t, shape.y);
+    CLAMP(float, exposure_time_us);
+    CLAMP(float, line_interval_us);
+    changed |= config_diff(self, props, force);
+
+    WRITE_STAGE(
+      Config_Roi,
+      set_roi(self, props, &metadata, !force && !(adjusted & Config_Roi)));
+    WRITE_STAGE(Config_LineInterval,
+                prop_write_scaled(f32,
+                                  hdcam,
+                                  DCAM_IDPROP_INTERNAL_LINEINTERVAL,
+                                  1e-6f,
+                                  &props->line_interval_us));
+    WRITE_STAGE(Config_Exposure,
+                prop_write_scaled(f32,
+                                  hdcam,
+                                  DCAM_IDPROP_EXPOSURETIME,
+                                  1e-6f,
+                                  &props->exposure_time_us));
+    WRITE_STAGE(Config_InputTriggers,
+                set_input_triggering(hdcam, props, &self->trigger_source));
+    WRITE_STAGE(Config_OutputTriggers, set_output_triggering(hdcam, props));
+#undef CLAMP
+#undef WRITE_STAGE
 
-    if (memcmp(&props->input_triggers,
-               &self->last_props.input_triggers,
-               sizeof(props->input_triggers)) != 0) {
-        is_ok &= set_input_triggering(hdcam, props);
-        is_ok &= set_output_triggering(hdcam, props);
-    }
-    if (is_ok)
+    if (is_ok) {
         self->last_props = *props;
+        // The camera may adjust other properties to suit new binning, so
+        // those need to be read back.
+        self->is_last_props_valid = !(changed & Config_Binning);
+    } else {
+        // The camera may be somewhere in between, so find out where, for the
+        // next change to be made against.
+        self->is_metadata_valid = 0;
+        struct CameraProperties actual;
+        read_properties__locked(self, &actual);
+    }
+
+    const uint64_t calls = dcam_call_count - calls_before;
+    self->status.configure.last_calls = (uint32_t)calls;
+    self->status.configure.total_calls += calls;
+    ++self->status.configure.count;
 
     return is_ok ? Device_Ok : Device_Err;
 }
@@ -655,6 +1115,7 @@ query_input_triggering(struct Dcam4Camera* self, struct CameraProperties* props)
         double source = 0.0;
         DCAM(
           dcamprop_getvalue(self->hdcam, DCAM_IDPROP_TRIGGERSOURCE, &source));
+        self->trigger_source = (int32_t)source;
         switch ((int)source) {
             case DCAMPROP_TRIGGERSOURCE__EXTERNAL:
                 event->enable = 1;
@@ -730,12 +1191,14 @@ Error:
     return 0;
 }
 
-enum DeviceStatusCode
-aq_dcam_get(const struct Camera* self_, struct CameraProperties* props)
+/// Reads the properties from the camera and remembers them in last_props.
+/// Must be called with the camera lock held.
+static enum DeviceStatusCode
+read_properties__locked(struct Dcam4Camera* self,
+                        struct CameraProperties* props)
 {
-    struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
-    lock_acquire(&self->lock);
     int is_ok = 1;
+    self->is_last_props_valid = 0;
 
     // roi
     is_ok &=
@@ -752,6 +1215,8 @@ aq_dcam_get(const struct Camera* self_, struct CameraProperties* props)
         double v;
         DCAM(dcamprop_getvalue(self->hdcam, DCAM_IDPROP_BUFFER_PIXELTYPE, &v));
         props->pixel_type = to_sample_type((DCAM_PIXELTYPE)v);
+        if (self->is_u8_from_u16 && v == DCAM_PIXELTYPE_MONO16)
+            props->pixel_type = SampleType_u8;
     }
 
     // binning
@@ -805,94 +1270,711 @@ aq_dcam_get(const struct Camera* self_, struct CameraProperties* props)
     CHECK(query_output_triggering(self, props));
 
     self->last_props = *props;
-    lock_release(&self->lock);
+    self->is_last_props_valid = is_ok;
     return is_ok ? Device_Ok : Device_Err;
 Error:
-    lock_release(&self->lock);
     return Device_Err;
 }
 
 enum DeviceStatusCode
-aq_dcam_get_shape(const struct Camera* self_, struct ImageShape* shape)
+aq_dcam_get(const struct Camera* self_, struct CameraProperties* props)
 {
     struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
+    enum DeviceStatusCode ecode = Device_Ok;
     lock_acquire(&self->lock);
-    struct image_descriptor desc = { 0 };
-    CHECK(get_image_description(self->hdcam, &desc));
+    if (self->is_last_props_valid)
+        *props = self->last_props;
+    else
+        ecode = read_properties__locked(self, props);
+    lock_release(&self->lock);
+    return ecode;
+}
 
-    memset(shape, 0, sizeof(*shape));
-    *shape =
-      (struct ImageShape){ .dims = { .channels = 1,
-                                     .width = desc.width,
-                                     .height = desc.height,
-                                     .planes = 1, },
-                           .strides = { .channels = 1,
-                                        .width = 1,
-                                        .height = desc.width,
-                                        .planes = desc.width * desc.height, },
-                           .type = to_sample_type(desc.pixel_type), };
+enum DeviceStatusCode
+aq_dcam_refresh(struct Camera* self_, struct CameraProperties* props)
+{
+    struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
+    lock_acquire(&self->lock);
+    self->is_metadata_valid = 0;
+    const enum DeviceStatusCode ecode = read_properties__locked(self, props);
     lock_release(&self->lock);
-    return Device_Ok;
-Error:
+    return ecode;
+}
+
+void
+aq_dcam_default_options(struct Dcam4Options* options)
+{
+    *options = (struct Dcam4Options){
+        .retrieval = Dcam4Retrieval_Newest,
+        .ring_depth = 10,
+        .ring_duration_ms = 1000.0f,
+        .ring_max_bytes = 1ULL << 30, // 1 GiB
+        .allocation = Dcam4Allocation_Dcam,
+        .numa_node = -1,
+        .use_huge_pages = 1,
+        .u8_source = Dcam4U8Source_Camera,
+        .u8_shift = 8,
+        .u8_black = 0,
+        .u8_white = UINT16_MAX,
+        .sw_bin_x = 1,
+        .sw_bin_y = 1,
+        .sw_decimate_x = 1,
+        .sw_decimate_y = 1,
+        .sw_bin_mode = Dcam4BinMode_Mean,
+        .use_capture_thread = 0,
+        .queue_depth = 16,
+        .frame_timeout_ms = -1,
+        .recovery_max_backoff_ms = 2000.0f,
+        .recovery_deadline_ms = 120000.0f,
+    };
+}
+
+enum DeviceStatusCode
+aq_dcam_get_options(const struct Camera* self_, struct Dcam4Options* options)
+{
+    struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
+    lock_acquire(&self->lock);
+    *options = self->options;
     lock_release(&self->lock);
-    return Device_Err;
+    return Device_Ok;
+}
+
+/// Whether changing the options from `a` to `b` changes the size of the
+/// frames get_frame() delivers.
+static int
+changes_delivered_shape(const struct Dcam4Options* a,
+                        const struct Dcam4Options* b)
+{
+    return a->sw_bin_x != b->sw_bin_x || a->sw_bin_y != b->sw_bin_y ||
+           a->sw_decimate_x != b->sw_decimate_x ||
+           a->sw_decimate_y != b->sw_decimate_y ||
+           a->pass_through_mono12p != b->pass_through_mono12p ||
+           a->u8_source != b->u8_source;
 }
 
 enum DeviceStatusCode
-aq_dcam_start(struct Camera* self_)
+aq_dcam_set_options(struct Camera* self_, const struct Dcam4Options* options)
 {
-    if (!self_) {
-        ERR("Expected non-NULL camera pointer.");
-        return Device_Err;
-    }
     struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
     lock_acquire(&self->lock);
-    int retries = 2;
-    while (retries-- > 0) {
-        TRACE("DCAM: Alloc framebuffers and start");
-        DCAM(dcambuf_alloc(self->hdcam, 10));
-        DCAM(dcamcap_start(self->hdcam, DCAMCAP_START_SEQUENCE));
-        break;
-    Error : {
-        if (retries <= 0)
-            goto Fail;
-        LOG("Attempting to reset driver");
-        struct Dcam4Camera* tmp = 0;
-        lock_release(&self->lock);
-        if ((tmp = reset_driver_and_replace_camera(self))) {
-            self = tmp;
-        }
-        lock_acquire(&self->lock);
-    } // end error block
-    } // end while(retries-->0)
+    EXPECT(options->retrieval == Dcam4Retrieval_Newest ||
+             options->retrieval == Dcam4Retrieval_Sequential,
+           "Unrecognized frame retrieval mode (%d).",
+           options->retrieval);
+    EXPECT(options->ring_depth >= 0,
+           "Ring depth must be positive, or 0 to size it automatically. "
+           "Got %d.",
+           options->ring_depth);
+    EXPECT(options->ring_depth > 0 || (options->ring_duration_ms > 0.0f &&
+                                       options->ring_max_bytes > 0),
+           "An automatically sized ring needs a positive duration and "
+           "memory budget.");
+    EXPECT(options->allocation == Dcam4Allocation_Dcam ||
+             options->allocation == Dcam4Allocation_Driver,
+           "Unrecognized ring allocation mode (%d).",
+           options->allocation);
+    EXPECT(options->u8_source == Dcam4U8Source_Camera ||
+             options->u8_source == Dcam4U8Source_Shift ||
+             options->u8_source == Dcam4U8Source_Window,
+           "Unrecognized 8-bit source (%d).",
+           options->u8_source);
+    EXPECT(options->u8_shift <= 8,
+           "The 8-bit shift must be at most 8 bits. Got %d.",
+           options->u8_shift);
+    EXPECT(options->u8_black < options->u8_white,
+           "The 8-bit window must have its black level below its white "
+           "level. Got [%d, %d].",
+           options->u8_black,
+           options->u8_white);
+    EXPECT(options->sw_bin_x > 0 && options->sw_bin_y > 0 &&
+             options->sw_decimate_x > 0 && options->sw_decimate_y > 0,
+           "Software binning and decimation factors must be at least 1.");
+    EXPECT(options->sw_bin_mode == Dcam4BinMode_Mean ||
+             options->sw_bin_mode == Dcam4BinMode_Sum,
+           "Unrecognized software binning mode (%d).",
+           options->sw_bin_mode);
+    EXPECT(!options->use_capture_thread || options->queue_depth > 0,
+           "The capture thread's queue must hold at least one frame. Got "
+           "%d.",
+           options->queue_depth);
+    EXPECT(options->frame_timeout_ms >= -1,
+           "The frame timeout must be at least 0 ms, or -1 to wait "
+           "indefinitely. Got %d.",
+           options->frame_timeout_ms);
+    EXPECT(options->recovery_max_backoff_ms > 0.0f &&
+             options->recovery_deadline_ms >= 0.0f,
+           "Recovery needs a positive backoff ceiling and a deadline of at "
+           "least 0 ms. Got %f ms and %f ms.",
+           options->recovery_max_backoff_ms,
+           options->recovery_deadline_ms);
+    // Consumers size their buffers from get_shape() when capture starts.
+    EXPECT(!self->is_desc_valid ||
+             !changes_delivered_shape(&self->options, options),
+           "Software binning, decimation, 12-bit pass-through and the 8-bit "
+           "source can't change while capture is running.");
+    self->options = *options;
     lock_release(&self->lock);
     return Device_Ok;
-Fail:
+Error:
     lock_release(&self->lock);
     return Device_Err;
 }
 
 enum DeviceStatusCode
-aq_dcam_stop(struct Camera* self_)
+aq_dcam_get_status(const struct Camera* self_, struct Dcam4Status* status)
 {
     struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
     lock_acquire(&self->lock);
-    DWRN(dcamwait_abort(self->wait));
-    DWRN(dcamcap_stop(self->hdcam));
-    DWRN(dcambuf_release(self->hdcam, 0));
+    *status = self->status;
     lock_release(&self->lock);
     return Device_Ok;
 }
 
+#ifdef AQ_DCAM_INSTRUMENT
+
 enum DeviceStatusCode
-aq_dcam_fire_software_trigger(struct Camera* self_)
+aq_dcam_get_call_stats(const struct Camera* self_,
+                       struct Dcam4CallStats* stats,
+                       uint32_t capacity,
+                       uint32_t* count)
 {
     struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
-
-    const HDCAM h = self->hdcam;
-    int trigger_source;
-    DCAM(prop_read(i32, h, DCAM_IDPROP_TRIGGERSOURCE, &trigger_source));
-
+    lock_acquire(&self->lock);
+    *count = dcam_stats_copy(self->hdcam, stats, capacity);
+    lock_release(&self->lock);
+    return Device_Ok;
+}
+
+static int
+cmp_total_ns_descending(const void* a_, const void* b_)
+{
+    const struct Dcam4CallStats* a = a_;
+    const struct Dcam4CallStats* b = b_;
+    return (a->total_ns < b->total_ns) - (a->total_ns > b->total_ns);
+}
+
+enum DeviceStatusCode
+aq_dcam_log_call_stats(const struct Camera* self_)
+{
+    struct Dcam4CallStats* stats = 0;
+    uint32_t count = 0;
+    CHECK(Device_Ok == aq_dcam_get_call_stats(self_, 0, 0, &count));
+    CHECK(stats = malloc(sizeof(*stats) * (count + 1)));
+    CHECK(Device_Ok == aq_dcam_get_call_stats(self_, stats, count, &count));
+    qsort(stats, count, sizeof(*stats), cmp_total_ns_descending);
+
+    LOG("DCAM calls, by total time:");
+    for (uint32_t i = 0; i < count; ++i) {
+        const struct Dcam4CallStats* c = stats + i;
+        char histogram[DCAM_STATS_BUCKETS * 20] = { 0 };
+        size_t n = 0;
+        for (int b = 0; b < DCAM_STATS_BUCKETS; ++b) {
+            if (c->histogram[b] && n < sizeof(histogram)) {
+                n += snprintf(histogram + n,
+                              sizeof(histogram) - n,
+                              " 2^%d:%llu",
+                              b,
+                              (unsigned long long)c->histogram[b]);
+            }
+        }
+        LOG("%s(0x%08x): %llu calls, %.1f us total, %.1f us mean, %.1f us "
+            "max. Calls by 2^i ns:%s",
+            c->function,
+            c->prop_id,
+            (unsigned long long)c->count,
+            1e-3 * (double)c->total_ns,
+            1e-3 * (double)c->total_ns / (double)c->count,
+            1e-3 * (double)c->max_ns,
+            histogram);
+    }
+    free(stats);
+    return Device_Ok;
+Error:
+    free(stats);
+    return Device_Err;
+}
+
+enum DeviceStatusCode
+aq_dcam_reset_call_stats(struct Camera* self_)
+{
+    struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
+    lock_acquire(&self->lock);
+    dcam_stats_reset(self->hdcam);
+    lock_release(&self->lock);
+    return Device_Ok;
+}
+
+#else
+
+enum DeviceStatusCode
+aq_dcam_get_call_stats(const struct Camera* self_,
+                       struct Dcam4CallStats* stats,
+                       uint32_t capacity,
+                       uint32_t* count)
+{
+    (void)self_;
+    (void)stats;
+    (void)capacity;
+    *count = 0;
+    LOG("DCAM call statistics need the driver to be built with "
+        "AQ_DCAM_INSTRUMENT.");
+    return Device_Err;
+}
+
+enum DeviceStatusCode
+aq_dcam_log_call_stats(const struct Camera* self_)
+{
+    uint32_t count = 0;
+    return aq_dcam_get_call_stats(self_, 0, 0, &count);
+}
+
+enum DeviceStatusCode
+aq_dcam_reset_call_stats(struct Camera* self_)
+{
+    uint32_t count = 0;
+    return aq_dcam_get_call_stats(self_, 0, 0, &count);
+}
+
+#endif
+
+enum DeviceStatusCode
+aq_dcam_get_shape(const struct Camera* self_, struct ImageShape* shape)
+{
+    struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
+    lock_acquire(&self->lock);
+    struct image_descriptor desc = { 0 };
+    CHECK(get_image_description__cached(self, &desc));
+
+    to_delivered_shape(self, &desc, shape);
+    lock_release(&self->lock);
+    return Device_Ok;
+Error:
+    lock_release(&self->lock);
+    return Device_Err;
+}
+
+/// Frames in the ring when it's sized automatically. DCAM needs a few
+/// frames to double buffer transfers.
+#define MIN_RING_DEPTH 3
+
+static int
+choose_ring_depth(struct Dcam4Camera* self, int32_t* depth)
+{
+    const struct Dcam4Options* o = &self->options;
+    if (o->ring_depth > 0) {
+        *depth = o->ring_depth;
+        return 1;
+    }
+
+    double interval_s = 0.0;
+    CHECK(prop_read(
+      f64, self->hdcam, DCAM_IDPROP_INTERNALFRAMEINTERVAL, &interval_s));
+    EXPECT(interval_s > 0.0, "Unexpected frame interval: %f s", interval_s);
+
+    const uint64_t bytes_of_frame =
+      (uint64_t)self->desc.offset +
+      (uint64_t)self->desc.pitch * (uint64_t)self->desc.height;
+    EXPECT(bytes_of_frame > 0, "Unexpected frame size: 0 bytes");
+
+    const double want = (double)o->ring_duration_ms / (1e3 * interval_s);
+    const uint64_t fit = o->ring_max_bytes / bytes_of_frame;
+    uint64_t n = (uint64_t)(want + 0.999);
+    if (n > fit)
+        n = fit;
+    if (n < MIN_RING_DEPTH) {
+        LOG("Memory budget of %llu bytes holds only %llu frames. Using %d.",
+            (unsigned long long)o->ring_max_bytes,
+            (unsigned long long)fit,
+            MIN_RING_DEPTH);
+        n = MIN_RING_DEPTH;
+    }
+    if (n > INT32_MAX)
+        n = INT32_MAX;
+    *depth = (int32_t)n;
+    TRACE("Auto-sized DCAM ring to %d frames", *depth);
+    return 1;
+Error:
+    return 0;
+}
+
+/// Frees the driver's side of the capture ring. Only safe once DCAM no
+/// longer holds the ring: after dcambuf_release() or dcamdev_close().
+void
+aq_dcam_forget_ring__inner(struct Dcam4Camera* self)
+{
+    self->ring.is_allocated = 0;
+    ring_memory_free(&self->ring_memory);
+    free(self->ring_frames);
+    self->ring_frames = 0;
+    self->status.ring.is_driver_allocated = 0;
+    self->status.ring.is_huge = 0;
+}
+
+/// Releases the capture ring, if one is allocated. Must be called with
+/// capture stopped.
+/// @returns 0 if DCAM refused, in which case the ring is kept.
+int
+aq_dcam_release_ring__inner(struct Dcam4Camera* self)
+{
+    if (self->ring.is_allocated)
+        DCAM(dcambuf_release(self->hdcam, 0));
+    aq_dcam_forget_ring__inner(self);
+    return 1;
+Error:
+    return 0;
+}
+
+/// Allocates the capture ring, or has DCAM allocate it, according to the
+/// options.
+static int
+alloc_ring(struct Dcam4Camera* self)
+{
+    const int32_t depth = self->status.ring.depth;
+    size_t bytes_of_frame = 0;
+    {
+        double v = 0.0;
+        CHECK(prop_read(f64, self->hdcam, DCAM_IDPROP_BUFFER_FRAMEBYTES, &v));
+        bytes_of_frame = (size_t)v;
+    }
+
+    if (self->options.allocation == Dcam4Allocation_Dcam) {
+        DCAM(dcambuf_alloc(self->hdcam, depth));
+        self->status.ring.bytes = (uint64_t)bytes_of_frame * depth;
+        goto Allocated;
+    }
+
+    {
+        // Start every frame on a page boundary.
+        const size_t page = ring_memory_page_size();
+        const size_t stride = (bytes_of_frame + page - 1) & ~(page - 1);
+        CHECK(self->ring_frames = (void**)malloc(depth * sizeof(void*)));
+        CHECK(ring_memory_alloc(&self->ring_memory,
+                                stride * depth,
+                                self->options.numa_node,
+                                self->options.use_huge_pages));
+        for (int32_t i = 0; i < depth; ++i)
+            self->ring_frames[i] = (uint8_t*)self->ring_memory.data + i * stride;
+    }
+
+    {
+        DCAMBUF_ATTACH attach = {
+            .size = sizeof(attach),
+            .iKind = DCAMBUF_ATTACHKIND_FRAME,
+            .buffer = self->ring_frames,
+            .buffercount = depth,
+        };
+        DCAM(dcambuf_attach(self->hdcam, &attach));
+    }
+    self->status.ring.bytes = self->ring_memory.bytes;
+    self->status.ring.is_driver_allocated = 1;
+    self->status.ring.is_huge = (uint8_t)self->ring_memory.is_huge;
+Allocated:
+    self->ring.is_allocated = 1;
+    self->ring.desc = self->desc;
+    self->ring.depth = depth;
+    self->ring.allocation = self->options.allocation;
+    self->ring.numa_node = self->options.numa_node;
+    self->ring.use_huge_pages = self->options.use_huge_pages;
+    ++self->status.ring.allocations;
+    return 1;
+Error:
+    ring_memory_free(&self->ring_memory);
+    free(self->ring_frames);
+    self->ring_frames = 0;
+    return 0;
+}
+
+/// Whether the ring kept from the last capture suits the next one: frames
+/// described by `self->desc`, in a ring `depth` frames deep, allocated as the
+/// options ask.
+static int
+is_ring_reusable(const struct Dcam4Camera* self, int32_t depth)
+{
+    const struct image_descriptor* a = &self->ring.desc;
+    const struct image_descriptor* b = &self->desc;
+    return self->ring.is_allocated && self->ring.depth == depth &&
+           a->pixel_type == b->pixel_type && a->offset == b->offset &&
+           a->pitch == b->pitch && a->width == b->width &&
+           a->height == b->height &&
+           self->ring.allocation == self->options.allocation &&
+           self->ring.numa_node == self->options.numa_node &&
+           self->ring.use_huge_pages == self->options.use_huge_pages;
+}
+
+/// Keeps the ring from the last capture if it still suits, otherwise
+/// replaces it. Reallocating can take longer than the rest of starting
+/// capture, so this matters for many short acquisitions.
+static int
+prepare_ring(struct Dcam4Camera* self)
+{
+    if (is_ring_reusable(self, self->status.ring.depth)) {
+        ++self->status.ring.reuses;
+        return 1;
+    }
+    CHECK(aq_dcam_release_ring__inner(self));
+    return alloc_ring(self);
+Error:
+    return 0;
+}
+
+/// When trigger `i` is due, in milliseconds since capture started.
+/// @returns 0 once the schedule is exhausted.
+static int
+scheduled_trigger_time(const struct Dcam4TriggerSchedule* schedule,
+                       uint64_t i,
+                       double* when_ms)
+{
+    if (schedule->count) {
+        if (i >= schedule->count)
+            return 0;
+        *when_ms = schedule->times_ms[i];
+    } else {
+        *when_ms = (double)i * schedule->period_ms;
+    }
+    return 1;
+}
+
+static int
+is_trigger_thread_running(struct Dcam4Camera* self)
+{
+    lock_acquire(&self->lock);
+    const int is_running = self->trigger.is_running;
+    lock_release(&self->lock);
+    return is_running;
+}
+
+/// Sleeps, then spins, until `deadline`.
+/// @returns 0 if the thread was asked to stop first.
+static int
+sleep_until(struct Dcam4Camera* self, struct clock* deadline)
+{
+    double remaining_ms = 0.0;
+    while ((remaining_ms = -clock_toc_ms(deadline)) > TRIGGER_SPIN_MS) {
+        if (!is_trigger_thread_running(self))
+            return 0;
+        const double sleep_ms = remaining_ms - TRIGGER_SPIN_MS;
+        clock_sleep_ms(0,
+                       sleep_ms < TRIGGER_POLL_MS ? sleep_ms : TRIGGER_POLL_MS);
+    }
+    while (clock_cmp_now(deadline) < 0) {
+    }
+    return 1;
+}
+
+/// Fires software triggers on schedule until the schedule runs out or
+/// aq_dcam_stop() asks it to exit. The camera lock is only taken between
+/// triggers, to record them.
+static void
+trigger_thread_main(void* self_)
+{
+    struct Dcam4Camera* self = (struct Dcam4Camera*)self_;
+    const struct Dcam4TriggerSchedule* schedule = &self->trigger.schedule;
+    struct clock started = self->trigger.started;
+    double when_ms = 0.0;
+    for (uint64_t i = 0; scheduled_trigger_time(schedule, i, &when_ms); ++i) {
+        struct clock deadline = started;
+        clock_shift_ms(&deadline, when_ms);
+        if (!sleep_until(self, &deadline))
+            break;
+        const double fired_ms = clock_toc_ms(&started);
+        const DCAMERR err = DCALL(dcamcap_firetrigger(self->hdcam, 0));
+
+        lock_acquire(&self->lock);
+        if (DISFAIL(err)) {
+            ERR("Failed to fire scheduled trigger %llu: %s",
+                (unsigned long long)i,
+                dcam_error_to_string(err));
+            ++self->status.triggers.failed;
+        } else {
+            const float late_ms = (float)(fired_ms - when_ms);
+            if (late_ms > self->status.triggers.max_late_ms)
+                self->status.triggers.max_late_ms = late_ms;
+            ++self->status.triggers.fired;
+        }
+        self->trigger.log[i % countof(self->trigger.log)].tag = i + 1;
+        self->trigger.log[i % countof(self->trigger.log)].fired_ms = fired_ms;
+        const int is_running = self->trigger.is_running;
+        lock_release(&self->lock);
+        if (!is_running)
+            break;
+    }
+}
+
+/// Must be called with the camera lock held, just after capture started.
+static int
+start_trigger_thread__locked(struct Dcam4Camera* self)
+{
+    const struct Dcam4TriggerSchedule* schedule = &self->trigger.schedule;
+    memset(&self->status.triggers, 0, sizeof(self->status.triggers));
+    memset(self->trigger.log, 0, sizeof(self->trigger.log));
+    if (schedule->period_ms <= 0.0 && !schedule->count)
+        return 1;
+    if (self->trigger_source != DCAMPROP_TRIGGERSOURCE__SOFTWARE) {
+        LOG("Software triggering isn't selected. Ignoring the trigger "
+            "schedule.");
+        return 1;
+    }
+    self->trigger.is_running = 1;
+    clock_init(&self->trigger.started);
+    thread_init(&self->trigger.thread);
+    EXPECT(thread_create(&self->trigger.thread, trigger_thread_main, self),
+           "Failed to start the trigger thread.");
+    self->trigger.is_started = 1;
+    return 1;
+Error:
+    self->trigger.is_running = 0;
+    return 0;
+}
+
+/// Must be called with the camera lock held. Releases the lock while
+/// joining the thread.
+static void
+stop_trigger_thread__locked(struct Dcam4Camera* self)
+{
+    if (!self->trigger.is_started)
+        return;
+    self->trigger.is_running = 0;
+    lock_release(&self->lock);
+    thread_join(&self->trigger.thread);
+    lock_acquire(&self->lock);
+    self->trigger.is_started = 0;
+}
+
+/// Sizes each slot of the capture thread's queue for a frame as
+/// aq_dcam_get_shape() describes it, following a struct queued_frame.
+/// Must be called with the camera lock held.
+static int
+alloc_queue__locked(struct Dcam4Camera* self)
+{
+    frame_queue_destroy(&self->capture.queue);
+    memset(&self->status.queue, 0, sizeof(self->status.queue));
+    if (!self->options.use_capture_thread)
+        return 1;
+
+    struct ImageShape shape;
+    to_delivered_shape(self, &self->desc, &shape);
+    CHECK(frame_queue_init(&self->capture.queue,
+                           self->options.queue_depth,
+                           bytes_of_queued_frame_header() +
+                             bytes_of_shape(&shape)));
+    self->status.queue.depth = self->options.queue_depth;
+    return 1;
+Error:
+    return 0;
+}
+
+static void
+capture_thread_main(void* self_);
+
+/// Must be called with the camera lock held, after capture has started.
+static int
+start_capture_thread__locked(struct Dcam4Camera* self)
+{
+    if (!self->options.use_capture_thread)
+        return 1;
+    self->capture.is_running = 1;
+    thread_init(&self->capture.thread);
+    EXPECT(thread_create(&self->capture.thread, capture_thread_main, self),
+           "Failed to start the capture thread.");
+    self->capture.is_started = 1;
+    return 1;
+Error:
+    self->capture.is_running = 0;
+    return 0;
+}
+
+enum DeviceStatusCode
+aq_dcam_start(struct Camera* self_)
+{
+    if (!self_) {
+        ERR("Expected non-NULL camera pointer.");
+        return Device_Err;
+    }
+    struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
+    lock_acquire(&self->lock);
+    int retries = 3;
+    while (retries-- > 0) {
+        TRACE("DCAM: Alloc framebuffers and start");
+        // Recovering the camera won't fix these, so they fail straight away.
+        if (!get_image_description(self->hdcam, &self->desc) ||
+            !choose_ring_depth(self, &self->status.ring.depth))
+            goto Fail;
+        CHECK(prepare_ring(self));
+        DCAM(dcamcap_start(self->hdcam, DCAMCAP_START_SEQUENCE));
+        break;
+    Error : {
+        if (retries <= 0)
+            goto Fail;
+        // Reopen just this camera first, then fall back to resetting DCAM.
+        LOG("Attempting to recover the camera");
+        lock_release(&self->lock);
+        const int is_recovered = aq_dcam_recover(self, retries > 1);
+        lock_acquire(&self->lock);
+        if (!is_recovered)
+            goto Fail;
+    } // end error block
+    } // end while(retries-->0)
+
+    self->is_desc_valid = 1;
+    memset(&self->cursor, 0, sizeof(self->cursor));
+    memset(&self->last_frame, 0, sizeof(self->last_frame));
+    if (!alloc_queue__locked(self) || !start_capture_thread__locked(self) ||
+        !start_trigger_thread__locked(self)) {
+        // Stops capture and any thread already started.
+        lock_release(&self->lock);
+        aq_dcam_stop(self_);
+        return Device_Err;
+    }
+    lock_release(&self->lock);
+    return Device_Ok;
+Fail:
+    lock_release(&self->lock);
+    return Device_Err;
+}
+
+enum DeviceStatusCode
+aq_dcam_stop(struct Camera* self_)
+{
+    struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
+    lock_acquire(&self->lock);
+    stop_trigger_thread__locked(self);
+    DWRN(dcamwait_abort(self->wait));
+    if (self->capture.is_started) {
+        // The thread waits with a timeout, so it notices the request even if
+        // the abort came before its wait started.
+        self->capture.is_running = 0;
+        lock_release(&self->lock);
+        thread_join(&self->capture.thread);
+        lock_acquire(&self->lock);
+        self->capture.is_started = 0;
+    }
+    DWRN(dcamcap_stop(self->hdcam));
+    // The ring is kept for the next start. See prepare_ring().
+    free(self->scratch);
+    self->scratch = 0;
+    self->scratch_bytes = 0;
+    self->locked_frame.is_locked = 0;
+    self->is_desc_valid = 0;
+    lock_release(&self->lock);
+    return Device_Ok;
+}
+
+enum DeviceStatusCode
+aq_dcam_fire_software_trigger(struct Camera* self_)
+{
+    struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
+
+    const HDCAM h = self->hdcam;
+    // The source is remembered whenever triggering is set or queried, so
+    // usually this is just the call to fire the trigger.
+    lock_acquire(&self->lock);
+    int32_t trigger_source = self->trigger_source;
+    if (!trigger_source &&
+        prop_read(i32, h, DCAM_IDPROP_TRIGGERSOURCE, &trigger_source))
+        self->trigger_source = trigger_source;
+    lock_release(&self->lock);
+    EXPECT(trigger_source, "Failed to read the trigger source.");
+
     if (trigger_source != DCAMPROP_TRIGGERSOURCE__SOFTWARE) {
 
         // Force a software trigger by temporarily disabling external
@@ -916,44 +1998,635 @@ Error:
 }
 
 enum DeviceStatusCode
-aq_dcam_get_frame(struct Camera* self_,
-                  void* im,
-                  size_t* nbytes,
-                  struct ImageInfo* info_)
+aq_dcam_set_trigger_schedule(struct Camera* self_,
+                             const struct Dcam4TriggerSchedule* schedule)
 {
     struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
+    double* times_ms = 0;
+    lock_acquire(&self->lock);
+    EXPECT(!self->trigger.is_started,
+           "The trigger schedule can't be changed while capture runs.");
+    EXPECT(schedule->count || schedule->period_ms >= 0.0,
+           "The trigger period can't be negative. Got %f ms.",
+           schedule->period_ms);
+    if (schedule->count) {
+        CHECK(schedule->times_ms);
+        for (uint32_t i = 1; i < schedule->count; ++i) {
+            EXPECT(schedule->times_ms[i - 1] <= schedule->times_ms[i],
+                   "Trigger times must be in increasing order.");
+        }
+        CHECK(times_ms =
+                (double*)malloc(schedule->count * sizeof(*times_ms)));
+        memcpy(times_ms,
+               schedule->times_ms,
+               schedule->count * sizeof(*times_ms));
+    }
+    free((void*)self->trigger.schedule.times_ms);
+    self->trigger.schedule = (struct Dcam4TriggerSchedule){
+        .period_ms = schedule->count ? 0.0 : schedule->period_ms,
+        .times_ms = times_ms,
+        .count = schedule->count,
+    };
+    lock_release(&self->lock);
+    return Device_Ok;
+Error:
+    lock_release(&self->lock);
+    return Device_Err;
+}
+
+enum DeviceStatusCode
+aq_dcam_get_trigger_time(const struct Camera* self_,
+                         uint64_t hardware_frame_id,
+                         double* fired_ms)
+{
+    struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
+    lock_acquire(&self->lock);
+    const size_t i = hardware_frame_id % countof(self->trigger.log);
+    EXPECT(self->trigger.log[i].tag == hardware_frame_id + 1,
+           "No scheduled trigger was recorded for frame %llu.",
+           (unsigned long long)hardware_frame_id);
+    *fired_ms = self->trigger.log[i].fired_ms;
+    lock_release(&self->lock);
+    return Device_Ok;
+Error:
+    lock_release(&self->lock);
+    return Device_Err;
+}
+
+/// Outcome of await_frame__locked().
+enum await_result
+{
+    Await_Frame = 0, // there's a frame to deliver
+    Await_Timeout,
+    Await_Aborted,
+    Await_Error,
+};
+
+static DCAMERR
+wait_for_frame(struct Dcam4Camera* self, int32_t timeout_ms)
+{
     DCAMWAIT_START p = {
         .size = sizeof(p),
         .eventmask = (int32)DCAMWAIT_CAPEVENT_FRAMEREADY,
-        .timeout = (int32)DCAMWAIT_TIMEOUT_INFINITE,
+        .timeout = (int32)timeout_ms,
+    };
+    return DCALL(dcamwait_start(self->wait, &p));
+}
+
+/// Makes sure there's a frame to deliver, waiting on the camera if needed.
+/// Gives up after `timeout_ms`, which may be DCAMWAIT_TIMEOUT_INFINITE.
+/// Must be called with the camera lock held. The lock is released during the
+/// wait so aq_dcam_stop() can abort it.
+static enum await_result
+await_frame__locked(struct Dcam4Camera* self, int32_t timeout_ms)
+{
+    if (self->options.retrieval == Dcam4Retrieval_Sequential &&
+        self->cursor.next < self->cursor.count)
+        return Await_Frame;
+
+    const int is_bounded = timeout_ms != DCAMWAIT_TIMEOUT_INFINITE;
+    struct clock deadline;
+    clock_init(&deadline);
+    if (is_bounded)
+        clock_shift_ms(&deadline, timeout_ms);
+
+    // A wake-up doesn't always bring a frame that hasn't been delivered yet,
+    // so keep waiting until one arrives.
+    int32_t wait_ms = timeout_ms;
+    for (;;) {
+        lock_release(&self->lock);
+        DCAMERR dcamwait_start_result = wait_for_frame(self, wait_ms);
+        lock_acquire(&self->lock);
+
+        if (dcamwait_start_result == DCAMERR_ABORT) {
+            LOG("CAMERA ABORT");
+            return Await_Aborted;
+        }
+        if (dcamwait_start_result == DCAMERR_TIMEOUT && is_bounded)
+            return Await_Timeout;
+        if (dcamwait_start_result == DCAMERR_LOSTFRAME) {
+            // The missing frames are counted from the framestamps when the
+            // next frame is delivered.
+            LOG("DCAM reported lost frames.");
+        } else {
+            DCAM(dcamwait_start_result);
+        }
+
+        DCAMCAP_TRANSFERINFO transfer = {
+            .size = sizeof(transfer),
+            .iKind = DCAMCAP_TRANSFERKIND_FRAME,
+        };
+        DCAM(dcamcap_transferinfo(self->hdcam, &transfer));
+        self->cursor.count = transfer.nFrameCount;
+        self->cursor.newest_index = transfer.nNewestFrameIndex;
+        if (self->cursor.next < self->cursor.count)
+            return Await_Frame;
+
+        if (is_bounded) {
+            const double remaining_ms = -clock_toc_ms(&deadline);
+            if (remaining_ms <= 0.0)
+                return Await_Timeout;
+            wait_ms = (int32_t)remaining_ms;
+        }
+    }
+Error:
+    return Await_Error;
+}
+
+/// Dcam4Options::frame_timeout_ms as a timeout for await_frame__locked().
+static int32_t
+frame_timeout__locked(const struct Dcam4Camera* self)
+{
+    return self->options.frame_timeout_ms < 0 ? DCAMWAIT_TIMEOUT_INFINITE
+                                              : self->options.frame_timeout_ms;
+}
+
+/// Picks the ring slot of the next frame to deliver and advances the cursor.
+/// Must be called with the camera lock held after await_frame__locked().
+/// @returns the ring slot.
+static int32_t
+select_frame__locked(struct Dcam4Camera* self, int32_t* frame_number)
+{
+    if (self->options.retrieval == Dcam4Retrieval_Newest) {
+        self->cursor.next = self->cursor.count;
+        *frame_number = self->cursor.count - 1;
+        return self->cursor.newest_index;
+    }
+
+    // In sequence mode DCAM writes frame n to slot n % depth. The
+    // oldest slot may already be receiving the next frame, so stay at least
+    // one slot behind the writer.
+    const int32_t behind = self->cursor.count - self->cursor.next;
+    if (behind >= self->status.ring.depth) {
+        const int32_t skipped = behind - (self->status.ring.depth - 1);
+        LOG("%d frames were overwritten in the DCAM ring before they could "
+            "be read.",
+            skipped);
+        self->cursor.next += skipped;
+        self->status.frames.overwritten += skipped;
+    }
+    *frame_number = self->cursor.next++;
+    return *frame_number % self->status.ring.depth;
+}
+
+/// Updates the frame counters for a frame that's about to be delivered.
+/// Must be called with the camera lock held.
+/// @returns the number of frames dropped just before this one.
+static uint32_t
+account_for_frame__locked(struct Dcam4Camera* self,
+                          int32_t frame_number,
+                          int32_t framestamp)
+{
+    uint32_t gap = 0;
+    if (self->last_frame.is_valid) {
+        // Frames the camera produced that weren't delivered. The framestamp
+        // may wrap around.
+        const int32_t missed =
+          (int32_t)((uint32_t)framestamp -
+                    (uint32_t)self->last_frame.framestamp) -
+          1;
+        // Frames that reached the ring but weren't delivered.
+        const int32_t unread = frame_number - self->last_frame.number - 1;
+        if (missed > unread) {
+            LOG("%d frames were lost before reaching the DCAM ring.",
+                missed - unread);
+            self->status.frames.lost_in_transfer += missed - unread;
+        }
+        gap = (uint32_t)(missed > unread ? missed : unread);
+        if (gap) {
+            self->status.frames.dropped += gap;
+            self->status.frames.last_gap_frame_id = (uint32_t)framestamp;
+        }
+    }
+    self->last_frame.is_valid = 1;
+    self->last_frame.number = frame_number;
+    self->last_frame.framestamp = framestamp;
+    ++self->status.frames.delivered;
+    return gap;
+}
+
+/// Makes sure the scratch space holds at least `bytes`.
+/// Must be called with the camera lock held.
+static int
+reserve_scratch__locked(struct Dcam4Camera* self, size_t bytes)
+{
+    if (bytes <= self->scratch_bytes)
+        return 1;
+    void* scratch = realloc(self->scratch, bytes);
+    EXPECT(scratch,
+           "Failed to allocate %llu bytes of scratch space.",
+           (unsigned long long)bytes);
+    self->scratch = scratch;
+    self->scratch_bytes = bytes;
+    return 1;
+Error:
+    return 0;
+}
+
+static void
+convert_to_u8(const struct Dcam4Options* o,
+              void* dst,
+              const void* src,
+              size_t width,
+              size_t src_pitch,
+              size_t height)
+{
+    if (o->u8_source == Dcam4U8Source_Window) {
+        window_u16_to_u8_rows(
+          dst, src, width, src_pitch, height, o->u8_black, o->u8_white);
+    } else {
+        shift_u16_to_u8_rows(dst, src, width, src_pitch, height, o->u8_shift);
+    }
+}
+
+/// Runs a frame from the ring through get_frame()'s processing stages into
+/// `im`, packed tightly: unpacking 12-bit pixels, software binning and
+/// conversion to 8 bits. Only the stages that apply are run. Intermediate
+/// results go to the scratch space.
+/// Must be called with the camera lock held.
+static int
+process_frame__locked(struct Dcam4Camera* self,
+                      const struct image_descriptor* d,
+                      void* im,
+                      const void* src,
+                      size_t src_pitch)
+{
+    const int is_unpacking = is_unpacking_mono12p(self, d);
+    const int is_binned = is_binning(self, d);
+    const int is_to_u8 = is_converting_to_u8(self, d);
+    size_t width = d->width, height = d->height;
+
+    if (!is_unpacking && !is_binned && !is_to_u8) {
+        copy_packed_rows(im, src, bytes_of_packed_row(d), src_pitch, height);
+        return 1;
+    }
+
+    // Room for two 16-bit frames, one for each stage that may feed another,
+    // and for the binning sums.
+    const size_t bytes_of_stage = 2 * width * height;
+    CHECK(reserve_scratch__locked(self,
+                                  2 * bytes_of_stage +
+                                    width * sizeof(uint32_t)));
+    uint8_t* stages[2] = { (uint8_t*)self->scratch,
+                           (uint8_t*)self->scratch + bytes_of_stage };
+    uint32_t* acc = (uint32_t*)(stages[1] + bytes_of_stage);
+
+    size_t bytes_per_pixel = d->pixel_type == DCAM_PIXELTYPE_MONO8 ? 1 : 2;
+    if (is_unpacking) {
+        void* out = is_binned ? stages[0] : im;
+        unpack_mono12p_rows(out, src, width, src_pitch, height);
+        src = out;
+        src_pitch = 2 * width;
+    }
+    if (is_binned) {
+        const struct binning b = to_binning(&self->options);
+        void* out = is_to_u8 ? stages[1] : im;
+        bin_rows(out,
+                 src,
+                 width,
+                 src_pitch,
+                 height,
+                 bytes_per_pixel,
+                 &b,
+                 acc);
+        width = binned_size(width, b.bin_x, b.step_x);
+        height = binned_size(height, b.bin_y, b.step_y);
+        src = out;
+        src_pitch = bytes_per_pixel * width;
+    }
+    if (is_to_u8)
+        convert_to_u8(&self->options, im, src, width, src_pitch, height);
+    return 1;
+Error:
+    return 0;
+}
+
+/// Copies the next frame into `im`, as aq_dcam_get_shape() describes it,
+/// whatever the row pitch of the DCAM ring. `gap` receives the number of
+/// frames dropped just before it.
+/// Must be called with the camera lock held after await_frame__locked().
+static int
+copy_frame__locked(struct Dcam4Camera* self,
+                   void* im,
+                   size_t* nbytes,
+                   struct ImageInfo* info,
+                   uint32_t* gap)
+{
+    int32_t frame_number = 0;
+    struct image_descriptor d;
+    CHECK(get_image_description__cached(self, &d));
+    DCAMBUF_FRAME frame = {
+        .size = sizeof(frame),
+        .iFrame = select_frame__locked(self, &frame_number),
     };
-    DCAMERR dcamwait_start_result = dcamwait_start(self->wait, &p);
+    DCAM(dcambuf_lockframe(self->hdcam, &frame));
+    CHECK(process_frame__locked(self, &d, im, frame.buf, frame.rowbytes));
+    *gap = account_for_frame__locked(self, frame_number, frame.framestamp);
+    to_delivered_shape(self, &d, &info->shape);
+    *nbytes = bytes_of_shape(&info->shape);
+    to_image_info(&frame, info);
+    return 1;
+Error:
+    return 0;
+}
+
+/// Must be called with the camera lock held after await_frame__locked().
+static int
+copy_frame_to_queue__locked(struct Dcam4Camera* self, struct queued_frame* f)
+{
+    struct image_descriptor d;
+    CHECK(get_image_description__cached(self, &d));
+    struct ImageShape shape;
+    to_delivered_shape(self, &d, &shape);
+    EXPECT(bytes_of_queued_frame_header() + bytes_of_shape(&shape) <=
+             self->capture.queue.slot_bytes,
+           "Frames no longer fit in the capture thread's queue. Restart "
+           "capture after changing software binning.");
+    CHECK(copy_frame__locked(self,
+                             (uint8_t*)f + bytes_of_queued_frame_header(),
+                             &f->nbytes,
+                             &f->info,
+                             &f->gap));
+    return 1;
+Error:
+    return 0;
+}
 
+/// Copies frames from the DCAM ring into the capture thread's queue as they
+/// arrive, until aq_dcam_stop() asks it to exit or something fails.
+static void
+capture_thread_main(void* self_)
+{
+    struct Dcam4Camera* self = (struct Dcam4Camera*)self_;
+    struct frame_queue* q = &self->capture.queue;
+    int is_stalled = 0;
     lock_acquire(&self->lock);
-    if (dcamwait_start_result == DCAMERR_ABORT) {
-        *nbytes = 0;
-        LOG("CAMERA ABORT");
-        goto Error;
+    while (self->capture.is_running) {
+        struct queued_frame* f = (struct queued_frame*)frame_queue_reserve(q);
+        if (!f) {
+            // Leave frames in the DCAM ring until the consumer catches up.
+            self->status.queue.stalls += !is_stalled;
+            is_stalled = 1;
+            lock_release(&self->lock);
+            clock_sleep_ms(0, QUEUE_POLL_MS);
+            lock_acquire(&self->lock);
+            continue;
+        }
+        is_stalled = 0;
+
+        const enum await_result r =
+          await_frame__locked(self, CAPTURE_THREAD_WAIT_MS);
+        if (r == Await_Timeout)
+            continue;
+        if (r == Await_Aborted)
+            break;
+        if (r == Await_Error || !copy_frame_to_queue__locked(self, f)) {
+            ERR("The capture thread stopped after an error.");
+            break;
+        }
+        frame_queue_commit(q);
+
+        const int32_t n = (int32_t)frame_queue_size(q);
+        if (n > self->status.queue.high_water)
+            self->status.queue.high_water = n;
     }
-    DCAM(dcamwait_start_result);
+    self->capture.is_running = 0;
+    frame_queue_close(q);
+    lock_release(&self->lock);
+}
 
-    {
+/// Finds the oldest frame in the capture thread's queue, waiting up to
+/// `timeout_ms` for one if it's empty, or indefinitely if it's negative.
+/// Doesn't take the camera lock.
+/// @returns Await_Aborted once the thread has exited and the queue is
+///          drained.
+static enum await_result
+front_of_queue(struct Dcam4Camera* self,
+               int32_t timeout_ms,
+               const struct queued_frame** f)
+{
+    struct frame_queue* q = &self->capture.queue;
+    struct clock deadline;
+    clock_init(&deadline);
+    clock_shift_ms(&deadline, timeout_ms);
+    while (!(*f = (const struct queued_frame*)frame_queue_front(q))) {
+        if (frame_queue_is_closed(q)) {
+            // The last frame may have been committed just before closing.
+            *f = (const struct queued_frame*)frame_queue_front(q);
+            return *f ? Await_Frame : Await_Aborted;
+        }
+        if (timeout_ms >= 0 && clock_cmp_now(&deadline) >= 0)
+            return Await_Timeout;
+        frame_queue_wait(q, timeout_ms < 0 ? -1.0 : -clock_toc_ms(&deadline));
+    }
+    return Await_Frame;
+}
+
+/// Pops frames from the capture thread's queue into `im`, waiting for the
+/// first one as long as Dcam4Options::frame_timeout_ms allows. Stops when
+/// `max_frames` are copied, the queue is empty or the next frame doesn't fit.
+/// `gaps` may be NULL.
+static enum DeviceStatusCode
+pop_frames(struct Dcam4Camera* self,
+           void* im,
+           size_t bytes_of_im,
+           struct ImageInfo* info,
+           uint32_t* gaps,
+           size_t max_frames,
+           size_t* nframes,
+           size_t* nbytes)
+{
+    *nframes = 0;
+    *nbytes = 0;
+    const struct queued_frame* f = 0;
+    const enum await_result r =
+      front_of_queue(self, self->options.frame_timeout_ms, &f);
+    if (r == Await_Timeout)
+        return Device_Ok;
+    EXPECT(r == Await_Frame, "The capture thread isn't running.");
+    EXPECT(f->nbytes <= bytes_of_im,
+           "Buffer too small. Need %llu bytes for a frame. Got %llu.",
+           (unsigned long long)f->nbytes,
+           (unsigned long long)bytes_of_im);
+    do {
+        memcpy((uint8_t*)im + *nbytes,
+               (const uint8_t*)f + bytes_of_queued_frame_header(),
+               f->nbytes);
+        *nbytes += f->nbytes;
+        if (gaps)
+            gaps[*nframes] = f->gap;
+        info[(*nframes)++] = f->info;
+        frame_queue_pop(&self->capture.queue);
+    } while (*nframes < max_frames &&
+             (f = (const struct queued_frame*)frame_queue_front(
+                &self->capture.queue)) &&
+             *nbytes + f->nbytes <= bytes_of_im);
+    return Device_Ok;
+Error:
+    return Device_Err;
+}
+
+enum DeviceStatusCode
+aq_dcam_get_frame(struct Camera* self_,
+                  void* im,
+                  size_t* nbytes,
+                  struct ImageInfo* info_)
+{
+    struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
+    lock_acquire(&self->lock);
+    if (self->capture.queue.data) {
+        // Only aq_dcam_start() replaces the queue, and it mustn't overlap
+        // with consumers, so the queue can be read without the lock.
+        lock_release(&self->lock);
+        size_t nframes = 0;
+        return pop_frames(self, im, SIZE_MAX, info_, 0, 1, &nframes, nbytes);
+    }
+    *nbytes = 0;
+    const enum await_result r =
+      await_frame__locked(self, frame_timeout__locked(self));
+    CHECK(r == Await_Frame || r == Await_Timeout);
+    if (r == Await_Frame) {
+        uint32_t gap = 0;
+        CHECK(copy_frame__locked(self, im, nbytes, info_, &gap));
+    }
+    lock_release(&self->lock);
+    return Device_Ok;
+Error:
+    lock_release(&self->lock);
+    return Device_Err;
+}
+
+enum DeviceStatusCode
+aq_dcam_get_frames(struct Camera* self_,
+                   void* im,
+                   size_t bytes_of_im,
+                   struct ImageInfo* info,
+                   uint32_t* gaps,
+                   size_t max_frames,
+                   size_t* nframes,
+                   size_t* nbytes)
+{
+    struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
+    lock_acquire(&self->lock);
+    if (self->capture.queue.data) {
+        // See aq_dcam_get_frame().
+        lock_release(&self->lock);
+        return pop_frames(
+          self, im, bytes_of_im, info, gaps, max_frames, nframes, nbytes);
+    }
+    *nframes = 0;
+    *nbytes = 0;
+    EXPECT(self->options.retrieval == Dcam4Retrieval_Sequential,
+           "Batched frame retrieval requires sequential retrieval.");
+    const enum await_result r =
+      await_frame__locked(self, frame_timeout__locked(self));
+    CHECK(r == Await_Frame || r == Await_Timeout);
+
+    if (r == Await_Frame) {
+        struct image_descriptor d;
+        CHECK(get_image_description__cached(self, &d));
+        struct ImageShape shape;
+        to_delivered_shape(self, &d, &shape);
+        const size_t bytes_of_frame = bytes_of_shape(&shape);
+        EXPECT(bytes_of_frame <= bytes_of_im,
+               "Buffer too small. Need %llu bytes for a frame. Got %llu.",
+               (unsigned long long)bytes_of_frame,
+               (unsigned long long)bytes_of_im);
+
+        while (*nframes < max_frames &&
+               self->cursor.next < self->cursor.count &&
+               *nbytes + bytes_of_frame <= bytes_of_im) {
+            size_t n = 0;
+            uint32_t gap = 0;
+            CHECK(copy_frame__locked(
+              self, (uint8_t*)im + *nbytes, &n, info + *nframes, &gap));
+            if (gaps)
+                gaps[*nframes] = gap;
+            *nbytes += n;
+            ++*nframes;
+        }
+    }
+
+    lock_release(&self->lock);
+    return Device_Ok;
+Error:
+    lock_release(&self->lock);
+    return Device_Err;
+}
+
+enum DeviceStatusCode
+aq_dcam_lock_frame(struct Camera* self_, struct Dcam4Frame* out)
+{
+    struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
+    lock_acquire(&self->lock);
+    memset(out, 0, sizeof(*out));
+    EXPECT(!self->capture.queue.data,
+           "Frames can't be locked in place while the capture thread is "
+           "used.");
+    EXPECT(!self->locked_frame.is_locked,
+           "Frame %d is still locked. Unlock it before locking another.",
+           self->locked_frame.index);
+    const enum await_result r =
+      await_frame__locked(self, frame_timeout__locked(self));
+    CHECK(r == Await_Frame || r == Await_Timeout);
+
+    if (r == Await_Frame) {
+        int32_t frame_number = 0;
         struct image_descriptor d;
-        CHECK(get_image_description(self->hdcam, &d));
+        CHECK(get_image_description__cached(self, &d));
         DCAMBUF_FRAME frame = {
             .size = sizeof(frame),
-            .iFrame = -1,
-            .buf = im,
-            .rowbytes = d.pitch,
-            .width = d.width,
-            .height = d.height,
+            .iFrame = select_frame__locked(self, &frame_number),
+        };
+        DCAM(dcambuf_lockframe(self->hdcam, &frame));
+
+        *out = (struct Dcam4Frame){
+            .data = frame.buf,
+            .pitch = frame.rowbytes,
+            .index = frame.iFrame,
+            .gap = account_for_frame__locked(
+              self, frame_number, frame.framestamp),
         };
-        DCAM(dcambuf_copyframe(self->hdcam, &frame));
-        *nbytes = (size_t)frame.rowbytes * frame.height;
+        to_image_shape(&d, 0, &out->info.shape);
+        to_image_info(&frame, &out->info);
 
-        info_->hardware_frame_id = (uint64_t)frame.framestamp;
-        info_->hardware_timestamp = (uint64_t)(1e6 * frame.timestamp.sec) +
-                                    (uint64_t)frame.timestamp.microsec;
+        self->locked_frame.is_locked = 1;
+        self->locked_frame.index = out->index;
+        self->locked_frame.frame_count = frame_number + 1;
+    }
+
+    lock_release(&self->lock);
+    return Device_Ok;
+Error:
+    lock_release(&self->lock);
+    return Device_Err;
+}
+enum DeviceStatusCode
+aq_dcam_unlock_frame(struct Camera* self_, struct Dcam4Frame* frame)
+{
+    struct Dcam4Camera* self = containerof(self_, struct Dcam4Camera, camera);
+    lock_acquire(&self->lock);
+    EXPECT(self->locked_frame.is_locked &&
+             self->locked_frame.index == frame->index,
+           "Frame %d is not locked.",
+           frame->index);
+    self->locked_frame.is_locked = 0;
+    frame->data = 0;
+
+    {
+        DCAMCAP_TRANSFERINFO transfer = {
+            .size = sizeof(transfer),
+            .iKind = DCAMCAP_TRANSFERKIND_FRAME,
+        };
+        DCAM(dcamcap_transferinfo(self->hdcam, &transfer));
+        const int32_t behind =
+          transfer.nFrameCount - self->locked_frame.frame_count;
+        EXPECT(behind < self->status.ring.depth,
+               "Frame %d was overwritten while it was locked (%d frames "
+               "behind with a ring of %d frames).",
+               frame->index,
+               behind,
+               self->status.ring.depth);
     }
 
     lock_release(&self->lock);
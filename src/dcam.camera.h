@@ -6,6 +6,9 @@
 #include "device/kit/camera.h"
 #include "device/kit/driver.h"
 #include "platform.h"
+#include "dcam.memory.h"
+#include "dcam.queue.h"
+#include "dcam.stats.h"
 
 #include <stddef.h> // must come before dcamapi4.h
 #include <dcamapi4.h>
@@ -15,42 +18,507 @@ extern "C"
 {
 #endif
 
+    struct image_descriptor
+    {
+        DCAM_PIXELTYPE pixel_type;
+        int32_t offset, pitch, width, height;
+    };
+
+    /// How frames are picked from the DCAM ring.
+    enum Dcam4Retrieval
+    {
+        // Each get_frame() waits for a new frame and delivers the newest one.
+        // Frames that arrive while the consumer is busy are skipped.
+        Dcam4Retrieval_Newest = 0,
+        // Every frame is delivered, oldest first. The camera is only waited
+        // on once all frames already in the ring have been delivered.
+        Dcam4Retrieval_Sequential,
+    };
+
+    /// Who allocates the DCAM capture ring.
+    enum Dcam4Allocation
+    {
+        // DCAM allocates the ring with dcambuf_alloc().
+        Dcam4Allocation_Dcam = 0,
+        // The driver allocates the ring and registers it with
+        // dcambuf_attach(). See Dcam4Options::numa_node and
+        // Dcam4Options::use_huge_pages.
+        Dcam4Allocation_Driver,
+    };
+
+    /// Where SampleType_u8 frames come from.
+    enum Dcam4U8Source
+    {
+        // The camera sends 8-bit pixels (DCAM_PIXELTYPE_MONO8).
+        Dcam4U8Source_Camera = 0,
+        // The camera sends 16-bit pixels and the driver shifts them right by
+        // Dcam4Options::u8_shift, saturating at 255.
+        Dcam4U8Source_Shift,
+        // The camera sends 16-bit pixels and the driver maps the window
+        // [Dcam4Options::u8_black, Dcam4Options::u8_white] onto [0, 255].
+        Dcam4U8Source_Window,
+    };
+
+    enum Dcam4BinMode
+    {
+        Dcam4BinMode_Mean = 0,
+        Dcam4BinMode_Sum, // saturates at the largest pixel value
+    };
+
+    /// Driver-specific settings that aren't part of CameraProperties.
+    /// See aq_dcam_default_options() for the defaults.
+    struct Dcam4Options
+    {
+        enum Dcam4Retrieval retrieval;
+
+        // Number of frames in the DCAM capture ring. Set to 0 to size the
+        // ring automatically when capture starts: deep enough to hold
+        // `ring_duration_ms` of frames at the current frame interval, but no
+        // larger than `ring_max_bytes`.
+        int32_t ring_depth;
+        float ring_duration_ms;
+        uint64_t ring_max_bytes;
+
+        // Only used with Dcam4Allocation_Driver. `numa_node` should be the
+        // node of the thread consuming frames, or -1 for no preference.
+        enum Dcam4Allocation allocation;
+        int32_t numa_node;
+        uint8_t use_huge_pages;
+
+        // With SampleType_u12, the camera sends packed 12-bit pixels
+        // (DCAM_PIXELTYPE_MONO12P) which are unpacked to 16 bits per pixel
+        // by default. Set this to deliver the packed rows as they are:
+        // get_shape() then reports SampleType_u8 rows of packed bytes.
+        uint8_t pass_through_mono12p;
+
+        // Takes effect when SampleType_u8 is next set on the camera.
+        // The shift and window may be changed at any time.
+        enum Dcam4U8Source u8_source;
+        uint8_t u8_shift;
+        uint16_t u8_black, u8_white;
+
+        // Software binning and decimation, applied by get_frame() on top of
+        // any binning done by the camera. Each output pixel combines a
+        // `sw_bin_x` by `sw_bin_y` block of pixels, and only every
+        // `sw_decimate_x`-th block across and `sw_decimate_y`-th block down
+        // is kept. Set all of them to 1 to turn this off. Ignored when
+        // packed 12-bit frames are passed through.
+        uint8_t sw_bin_x, sw_bin_y;
+        uint8_t sw_decimate_x, sw_decimate_y;
+        enum Dcam4BinMode sw_bin_mode;
+
+        // Independent horizontal and vertical binning by the camera, applied
+        // the next time properties are set. Leave both at 0 to bin both axes
+        // by CameraProperties::binning. Otherwise, 0 means no binning along
+        // that axis.
+        uint8_t binning_horz, binning_vert;
+
+        // Waits on the camera from a thread owned by the driver, which
+        // copies each frame into a queue of `queue_depth` frames as soon as
+        // it arrives. get_frame() and aq_dcam_get_frames() then take frames
+        // from the queue, so a consumer that stalls doesn't hold up draining
+        // the DCAM ring. Frames can't be locked in place while this is on.
+        // Takes effect the next time capture starts. Calls that take frames
+        // must not overlap with starting or stopping capture.
+        uint8_t use_capture_thread;
+        int32_t queue_depth;
+
+        // Longest get_frame(), aq_dcam_get_frames() and aq_dcam_lock_frame()
+        // wait for a frame, in milliseconds. When none arrives in time they
+        // succeed without delivering one: `nbytes` or `nframes` is 0, or the
+        // frame's `data` is NULL. 0 polls without blocking, and -1 waits
+        // until a frame arrives or capture stops.
+        int32_t frame_timeout_ms;
+
+        // When recovering a camera means restarting the DCAM API, restarts
+        // are retried with waits that double from a few tens of
+        // milliseconds up to `recovery_max_backoff_ms`, until
+        // `recovery_deadline_ms` has passed.
+        float recovery_max_backoff_ms;
+        float recovery_deadline_ms;
+    };
+
+    /// Driver state that isn't part of CameraProperties.
+    struct Dcam4Status
+    {
+        // The DCAM capture ring allocated by the last aq_dcam_start().
+        // `allocations` and `reuses` count, since the camera was opened, the
+        // starts that allocated a new ring and those that kept the last one.
+        struct
+        {
+            int32_t depth;
+            uint64_t bytes;
+            uint8_t is_driver_allocated;
+            uint8_t is_huge; // backed by large pages
+            uint32_t allocations;
+            uint32_t reuses;
+        } ring;
+
+        // Cumulative frame accounting since the camera was opened.
+        // Gaps are found by comparing the framestamp of each delivered frame
+        // with the one before it. Every missing frame counts as dropped, and
+        // is further attributed to the ring (overwritten before it was read)
+        // or to the transfer (never reached the ring). In
+        // Dcam4Retrieval_Newest mode, frames passed over for a newer one
+        // count as dropped only.
+        struct
+        {
+            uint64_t delivered;
+            uint64_t dropped;
+            uint64_t overwritten;
+            uint64_t lost_in_transfer;
+            // hardware_frame_id of the latest frame delivered after a gap.
+            // Each frame's gap is reported by aq_dcam_get_frames() and
+            // aq_dcam_lock_frame().
+            uint64_t last_gap_frame_id;
+        } frames;
+
+        // Binning done by the camera, as of the last time it was set.
+        struct
+        {
+            uint8_t horizontal, vertical;
+        } binning;
+
+        // Software triggers fired on schedule since the last aq_dcam_start().
+        // See aq_dcam_set_trigger_schedule().
+        struct
+        {
+            uint64_t fired;
+            uint64_t failed;
+            // Longest any trigger was fired after its scheduled time.
+            float max_late_ms;
+        } triggers;
+
+        // The capture thread's queue, since the last aq_dcam_start().
+        struct
+        {
+            int32_t depth;
+            int32_t high_water; // most frames ever waiting in the queue
+            // Times the capture thread found the queue full and left frames
+            // in the DCAM ring.
+            uint64_t stalls;
+        } queue;
+
+        // DCAM calls made by aq_dcam_set() to configure the camera, since
+        // the camera was opened.
+        struct
+        {
+            uint64_t count;       // times the camera was configured
+            uint64_t total_calls; // over all of them
+            uint32_t last_calls;  // by the most recent one
+        } configure;
+
+        // Recoveries from DCAM failures, since the camera was opened, and
+        // how the most recent one went.
+        struct
+        {
+            uint32_t count;         // recoveries attempted
+            uint32_t resets;        // of those, ones that restarted DCAM
+            uint32_t failed;        // of those, ones that didn't succeed
+            uint32_t last_attempts; // DCAM restarts tried by the last one
+            float last_ms;          // time taken by the last one
+            float max_ms;
+        } recovery;
+    };
+
+    /// When the driver fires software triggers on its own.
+    /// See aq_dcam_set_trigger_schedule().
+    struct Dcam4TriggerSchedule
+    {
+        // Fire every `period_ms`, starting when capture starts.
+        double period_ms;
+        // Or, when `count` isn't 0, fire once at each of `times_ms`, given
+        // in milliseconds since capture started, in increasing order.
+        const double* times_ms;
+        uint32_t count;
+    };
+
+    /// Ranges for independent horizontal and vertical binning.
+    struct Dcam4BinningMetadata
+    {
+        uint8_t is_independent_supported;
+        struct Property horizontal, vertical;
+    };
+
+    struct Dcam4Driver;
+
     struct Dcam4Camera
     {
         struct Camera camera;
+        struct Dcam4Driver* driver; // the driver that opened this camera
         HDCAM hdcam;
         HDCAMWAIT wait;
+        // Properties as last read from or written to the camera. While
+        // they're known to match the camera, aq_dcam_get() returns them
+        // without reading the camera.
         struct CameraProperties last_props;
+        int is_last_props_valid;
         struct lock lock;
+        struct Dcam4Options options;
+        struct Dcam4Status status;
+
+        // Ring memory registered with dcambuf_attach() when the driver
+        // allocates the ring. `frames` holds a pointer to each frame in it.
+        struct ring_memory ring_memory;
+        void** ring_frames;
+
+        // What the capture ring was allocated for. The ring is kept after
+        // aq_dcam_stop(), and reused by the next aq_dcam_start() if none of
+        // this has changed.
+        struct
+        {
+            int is_allocated;
+            struct image_descriptor desc;
+            int32_t depth;
+            enum Dcam4Allocation allocation;
+            int32_t numa_node;
+            uint8_t use_huge_pages;
+        } ring;
+
+        // Frame geometry, captured by aq_dcam_start() since it can't change
+        // while capture is running. Invalidated by aq_dcam_stop().
+        struct image_descriptor desc;
+        int is_desc_valid;
+
+        // Set when SampleType_u8 was requested but the camera was set to
+        // send 16-bit pixels for the driver to convert. See
+        // Dcam4Options::u8_source.
+        int is_u8_from_u16;
+
+        // Capability ranges as of the last time they were read. They depend
+        // on sensor mode, pixel type, binning and readout direction, so
+        // they're only read again after one of those is set.
+        struct CameraPropertyMetadata metadata;
+        int is_metadata_valid;
+
+        // DCAM_IDPROP_SENSORMODE as of the last time it was set, or 0 if it
+        // isn't known.
+        int32_t sensor_mode;
+
+        // Set once DCAM_IDPROP_SUBARRAYMODE is known to be on.
+        int is_subarray_mode_on;
+
+        // DCAM_IDPROP_TRIGGERSOURCE as of the last time triggering was set or
+        // queried, or 0 if it isn't known.
+        int32_t trigger_source;
+
+        // Dcam4Options::binning_horz and binning_vert as of the last time
+        // binning was set on the camera.
+        struct
+        {
+            uint8_t horz, vert;
+        } requested_binning;
+
+        // Intermediate frames for get_frame()'s processing stages. Grown as
+        // needed and freed by aq_dcam_stop().
+        void* scratch;
+        size_t scratch_bytes;
+
+        // See Dcam4Options::use_capture_thread. The queue is allocated by
+        // aq_dcam_start() when the thread is used, and kept until the next
+        // start so a consumer racing aq_dcam_stop() can still read it.
+        // Consumers read it without the camera lock, so they must not
+        // overlap with aq_dcam_start().
+        struct
+        {
+            struct thread thread;
+            int is_started; // the thread needs to be joined
+            int is_running; // cleared to ask the thread to exit
+            struct frame_queue queue;
+        } capture;
+
+        // Software triggers fired by the driver. See
+        // aq_dcam_set_trigger_schedule(). The schedule, and `times_ms`, which
+        // the driver owns, can't change while the thread runs.
+        struct
+        {
+            struct Dcam4TriggerSchedule schedule;
+            struct thread thread;
+            int is_started; // the thread needs to be joined
+            int is_running; // cleared to ask the thread to exit
+            struct clock started; // when capture started
+            // The time trigger n was fired, in milliseconds since capture
+            // started, is in log[n % 256], tagged with n + 1.
+            struct
+            {
+                uint64_t tag;
+                double fired_ms;
+            } log[256];
+        } trigger;
+
+        // Frame currently held by aq_dcam_lock_frame()
+        struct
+        {
+            int is_locked;
+            int32_t index;
+            int32_t frame_count; // DCAM frame count just after the frame
+        } locked_frame;
+
+        // Position in the stream of frames captured since aq_dcam_start()
+        struct
+        {
+            int32_t next;         // number of the next frame to deliver
+            int32_t count;        // frames written to the ring so far
+            int32_t newest_index; // ring slot holding the newest frame
+        } cursor;
+
+        // Last frame delivered since aq_dcam_start(), for finding gaps.
+        struct
+        {
+            int is_valid;
+            int32_t number;     // position in the ring's stream of frames
+            int32_t framestamp; // position in the camera's stream of frames
+        } last_frame;
     };
 
     struct Dcam4Driver
     {
         struct Driver driver;
+        // DCAM is initialized the first time a device is counted, described
+        // or opened. If that fails, as it does on a host without cameras,
+        // it isn't tried again until recovery restarts DCAM.
         DCAMAPI_INIT api_init;
-        struct Dcam4Camera* cameras[2];
+        int is_api_initialized;
+        int is_api_unavailable;
+        // Open cameras and identifiers by device id. Grows to fit the
+        // devices DCAM reports. An identifier's kind is DeviceKind_None until
+        // the device has been described.
+        struct Dcam4Camera** cameras;
+        struct DeviceIdentifier* identifiers;
+        uint32_t camera_capacity;
         struct lock lock;
     };
 
+    /// A frame held in place in the DCAM capture ring.
+    /// Filled by aq_dcam_lock_frame().
+    struct Dcam4Frame
+    {
+        void* data;      // first pixel of the frame in the DCAM ring
+        int32_t pitch;   // bytes between the starts of consecutive rows
+        int32_t index;   // ring slot holding the frame
+        uint32_t gap;    // frames dropped just before this one
+        struct ImageInfo info;
+    };
+
+    void aq_dcam_default_options(struct Dcam4Options* options);
+    enum DeviceStatusCode aq_dcam_get_options(const struct Camera*,
+                                              struct Dcam4Options* options);
+    enum DeviceStatusCode aq_dcam_set_options(
+      struct Camera*,
+      const struct Dcam4Options* options);
+
+    enum DeviceStatusCode aq_dcam_get_status(const struct Camera*,
+                                             struct Dcam4Status* status);
+
+    /// @brief Copies up to `capacity` entries of statistics on the DCAM calls
+    ///        made for the camera, one per function and property id.
+    /// @details Needs a driver built with AQ_DCAM_INSTRUMENT. Statistics
+    ///          cover the calls made since the camera was opened or they
+    ///          were last reset.
+    /// @param[out] count Number of entries available, which may be more
+    ///                   than `capacity`.
+    enum DeviceStatusCode aq_dcam_get_call_stats(const struct Camera*,
+                                                 struct Dcam4CallStats* stats,
+                                                 uint32_t capacity,
+                                                 uint32_t* count);
+
+    /// @brief Logs the statistics from aq_dcam_get_call_stats(), the calls
+    ///        that took the most time in total first.
+    enum DeviceStatusCode aq_dcam_log_call_stats(const struct Camera*);
+
+    /// @brief Clears the statistics from aq_dcam_get_call_stats().
+    enum DeviceStatusCode aq_dcam_reset_call_stats(struct Camera*);
+
     enum DeviceStatusCode aq_dcam_set(struct Camera*,
                                       struct CameraProperties* settings);
     enum DeviceStatusCode aq_dcam_get(const struct Camera*,
                                       struct CameraProperties* settings);
+
+    /// @brief Reads the properties from the camera, rather than returning
+    ///        the ones aq_dcam_get() remembers.
+    /// @details For when something other than this driver may have changed
+    ///          them. Later calls to aq_dcam_get() return what was read, and
+    ///          capability ranges are read again on their next use.
+    enum DeviceStatusCode aq_dcam_refresh(struct Camera*,
+                                          struct CameraProperties* settings);
+
     enum DeviceStatusCode aq_dcam_get_metadata(
       const struct Camera*,
       struct CameraPropertyMetadata* meta);
     enum DeviceStatusCode aq_dcam_get_shape(const struct Camera*,
                                             struct ImageShape* shape);
+
+    /// @brief Ranges for Dcam4Options::binning_horz and binning_vert.
+    enum DeviceStatusCode aq_dcam_get_binning_metadata(
+      const struct Camera*,
+      struct Dcam4BinningMetadata* meta);
     enum DeviceStatusCode aq_dcam_start(struct Camera*);
     enum DeviceStatusCode aq_dcam_stop(struct Camera*);
 
     enum DeviceStatusCode aq_dcam_fire_software_trigger(struct Camera*);
 
+    /// @brief Has the driver fire software triggers on a schedule while
+    ///        capture runs, from a thread with a high-resolution timer.
+    /// @details Only used while the software trigger (line 4) is the enabled
+    ///          input trigger, and takes effect the next time capture starts.
+    ///          `times_ms` is copied. Pass an empty schedule to turn it off.
+    ///          Can't be changed while capture runs.
+    enum DeviceStatusCode aq_dcam_set_trigger_schedule(
+      struct Camera*,
+      const struct Dcam4TriggerSchedule* schedule);
+
+    /// @brief When the scheduled trigger that produced the frame with
+    ///        `hardware_frame_id` was fired, in milliseconds since capture
+    ///        started.
+    /// @details Trigger n produces frame n. Only the last 256 triggers are
+    ///          remembered.
+    enum DeviceStatusCode aq_dcam_get_trigger_time(const struct Camera*,
+                                                   uint64_t hardware_frame_id,
+                                                   double* fired_ms);
+
     enum DeviceStatusCode aq_dcam_get_frame(struct Camera*,
                                             void* im,
                                             size_t* nbytes,
                                             struct ImageInfo* info);
 
+    /// @brief Copies every frame that has arrived since the last call into
+    ///        `im`, oldest first.
+    /// @details Requires Dcam4Retrieval_Sequential, unless frames come from
+    ///          the capture thread. Waits on the camera only if no frames are
+    ///          pending, so a consumer that fell behind drains the backlog
+    ///          with a single call.
+    /// @param[in] im Destination for the frames, packed back to back.
+    /// @param[in] bytes_of_im Capacity of `im` in bytes.
+    /// @param[out] info Receives the info for each frame copied. Must have
+    ///                  room for `max_frames` entries.
+    /// @param[out] gaps If not NULL, receives the number of frames dropped
+    ///                  just before each frame copied. Must have room for
+    ///                  `max_frames` entries.
+    /// @param[in] max_frames Maximum number of frames to copy.
+    /// @param[out] nframes Number of frames copied.
+    /// @param[out] nbytes Number of bytes written to `im`.
+    enum DeviceStatusCode aq_dcam_get_frames(struct Camera*,
+                                             void* im,
+                                             size_t bytes_of_im,
+                                             struct ImageInfo* info,
+                                             uint32_t* gaps,
+                                             size_t max_frames,
+                                             size_t* nframes,
+                                             size_t* nbytes);
+
+    /// @brief Waits for the next frame and locks it in the DCAM ring without
+    ///        copying it.
+    /// @details Only one frame may be locked at a time. The slot must be
+    ///          handed back with aq_dcam_unlock_frame() before the ring wraps
+    ///          around to it, otherwise the unlock reports an error since the
+    ///          data was overwritten while it was held.
+    enum DeviceStatusCode aq_dcam_lock_frame(struct Camera*,
+                                             struct Dcam4Frame* frame);
+
+    /// @brief Releases a frame locked by aq_dcam_lock_frame().
+    enum DeviceStatusCode aq_dcam_unlock_frame(struct Camera*,
+                                               struct Dcam4Frame* frame);
+
 #ifdef __cplusplus
 };
 #endif
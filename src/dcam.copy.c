@@ -0,0 +1,366 @@
+#include "dcam.copy.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+/// Copies `n` bytes with 32-byte vectors, four at a time.
+/// Stores are aligned to the destination. The unaligned ends are covered by
+/// two overlapping vectors, so short rows don't pay for a call to memcpy.
+static void
+copy_bytes(uint8_t* dst, const uint8_t* src, size_t n)
+{
+    if (n < 32) {
+        memcpy(dst, src, n);
+        return;
+    }
+    const __m256i first = _mm256_loadu_si256((const __m256i*)src);
+    const __m256i last = _mm256_loadu_si256((const __m256i*)(src + n - 32));
+    size_t i = (32 - ((uintptr_t)dst & 31)) & 31;
+    for (; i + 128 <= n; i += 128) {
+        const __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+        const __m256i b = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+        const __m256i c = _mm256_loadu_si256((const __m256i*)(src + i + 64));
+        const __m256i d = _mm256_loadu_si256((const __m256i*)(src + i + 96));
+        _mm256_store_si256((__m256i*)(dst + i), a);
+        _mm256_store_si256((__m256i*)(dst + i + 32), b);
+        _mm256_store_si256((__m256i*)(dst + i + 64), c);
+        _mm256_store_si256((__m256i*)(dst + i + 96), d);
+    }
+    for (; i + 32 <= n; i += 32) {
+        _mm256_store_si256((__m256i*)(dst + i),
+                           _mm256_loadu_si256((const __m256i*)(src + i)));
+    }
+    _mm256_storeu_si256((__m256i*)dst, first);
+    _mm256_storeu_si256((__m256i*)(dst + n - 32), last);
+}
+
+/// Unpacks 16 pixels at a time from a row of `width` pixels.
+/// Each step reads 32 bytes but only uses 24, so it stops while a whole
+/// vector can still be read from the `src_bytes` available.
+/// @returns the number of pixels unpacked.
+static size_t
+unpack_mono12p_row(uint16_t* dst,
+                   const uint8_t* src,
+                   size_t width,
+                   size_t src_bytes)
+{
+    // Put bytes 0-11 in the low lane and bytes 12-23 in the high lane.
+    const __m256i to_lanes = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+    // Gather the two bytes that hold each pixel into its 16-bit word.
+    const __m256i to_words = _mm256_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, //
+                                              6, 7, 7, 8, 9, 10, 10, 11,
+                                              0, 1, 1, 2, 3, 4, 4, 5, //
+                                              6, 7, 7, 8, 9, 10, 10, 11);
+    const __m256i low12 = _mm256_set1_epi16(0x0fff);
+    size_t x = 0;
+    for (; x + 16 <= width && x / 2 * 3 + 32 <= src_bytes; x += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + x / 2 * 3));
+        v = _mm256_permutevar8x32_epi32(v, to_lanes);
+        v = _mm256_shuffle_epi8(v, to_words);
+        // Even pixels are the low 12 bits of their word, odd pixels the
+        // high 12.
+        const __m256i even = _mm256_and_si256(v, low12);
+        const __m256i odd = _mm256_srli_epi16(v, 4);
+        _mm256_storeu_si256((__m256i*)(dst + x),
+                            _mm256_blend_epi16(even, odd, 0xaa));
+    }
+    return x;
+}
+
+/// Shifts 32 pixels at a time from a row of `width` pixels.
+/// @returns the number of pixels converted.
+static size_t
+shift_u16_to_u8_row(uint8_t* dst,
+                    const uint16_t* src,
+                    size_t width,
+                    uint8_t shift)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    const __m256i max = _mm256_set1_epi16(255);
+    size_t x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + x));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + x + 16));
+        // Saturate before packing, which treats the words as signed.
+        a = _mm256_min_epu16(_mm256_srl_epi16(a, count), max);
+        b = _mm256_min_epu16(_mm256_srl_epi16(b, count), max);
+        // Packing works within each 128-bit lane, so put the quarters back
+        // in order afterwards.
+        const __m256i v = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b),
+                                                   _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i*)(dst + x), v);
+    }
+    return x;
+}
+
+/// Maps 16 pixels at a time from a row of `width` pixels through the
+/// window starting at `black`, `range` wide. Must round exactly like
+/// window_one().
+/// @returns the number of pixels converted.
+static size_t
+window_u16_to_u8_row(uint8_t* dst,
+                     const uint16_t* src,
+                     size_t width,
+                     uint16_t black,
+                     uint16_t range,
+                     float scale)
+{
+    const __m256i lo = _mm256_set1_epi16((short)black);
+    const __m256i hi = _mm256_set1_epi16((short)range);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256 k = _mm256_set1_ps(scale);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + x));
+        v = _mm256_min_epu16(_mm256_subs_epu16(v, lo), hi);
+        __m256 a = _mm256_cvtepi32_ps(_mm256_unpacklo_epi16(v, zero));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_unpackhi_epi16(v, zero));
+        a = _mm256_add_ps(_mm256_mul_ps(a, k), half);
+        b = _mm256_add_ps(_mm256_mul_ps(b, k), half);
+        // unpacklo/hi and packus both work within lanes, so the words come
+        // back in order. The bytes end up in the low half of each lane.
+        const __m256i w =
+          _mm256_packus_epi32(_mm256_cvttps_epi32(a), _mm256_cvttps_epi32(b));
+        const __m256i y = _mm256_permute4x64_epi64(
+          _mm256_packus_epi16(w, w), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i*)(dst + x), _mm256_castsi256_si128(y));
+    }
+    return x;
+}
+
+/// Adds a row of pixels to the running column sums in `acc`, 8 at a time.
+/// @returns the number of pixels added.
+static size_t
+accumulate_u16_row(uint32_t* acc, const uint16_t* row, size_t width)
+{
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m256i v =
+          _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(row + x)));
+        const __m256i a = _mm256_loadu_si256((const __m256i*)(acc + x));
+        _mm256_storeu_si256((__m256i*)(acc + x), _mm256_add_epi32(a, v));
+    }
+    return x;
+}
+
+static size_t
+accumulate_u8_row(uint32_t* acc, const uint8_t* row, size_t width)
+{
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m256i v =
+          _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(row + x)));
+        const __m256i a = _mm256_loadu_si256((const __m256i*)(acc + x));
+        _mm256_storeu_si256((__m256i*)(acc + x), _mm256_add_epi32(a, v));
+    }
+    return x;
+}
+
+#else
+
+static void
+copy_bytes(uint8_t* dst, const uint8_t* src, size_t n)
+{
+    memcpy(dst, src, n);
+}
+
+static size_t
+unpack_mono12p_row(uint16_t* dst,
+                   const uint8_t* src,
+                   size_t width,
+                   size_t src_bytes)
+{
+    return 0; // every pixel goes through the scalar loop
+}
+
+static size_t
+shift_u16_to_u8_row(uint8_t* dst,
+                    const uint16_t* src,
+                    size_t width,
+                    uint8_t shift)
+{
+    return 0;
+}
+
+static size_t
+accumulate_u16_row(uint32_t* acc, const uint16_t* row, size_t width)
+{
+    return 0;
+}
+
+static size_t
+accumulate_u8_row(uint32_t* acc, const uint8_t* row, size_t width)
+{
+    return 0;
+}
+
+static size_t
+window_u16_to_u8_row(uint8_t* dst,
+                     const uint16_t* src,
+                     size_t width,
+                     uint16_t black,
+                     uint16_t range,
+                     float scale)
+{
+    return 0;
+}
+
+#endif
+
+void
+copy_packed_rows(void* dst,
+                 const void* src,
+                 size_t row_bytes,
+                 size_t src_pitch,
+                 size_t height)
+{
+    uint8_t* out = (uint8_t*)dst;
+    const uint8_t* in = (const uint8_t*)src;
+    if (src_pitch == row_bytes) {
+        // One contiguous block. The C library's memcpy is hard to beat here.
+        memcpy(out, in, row_bytes * height);
+        return;
+    }
+    for (size_t y = 0; y < height; ++y)
+        copy_bytes(out + y * row_bytes, in + y * src_pitch, row_bytes);
+}
+
+void
+unpack_mono12p_rows(void* dst,
+                    const void* src,
+                    size_t width,
+                    size_t src_pitch,
+                    size_t height)
+{
+    const size_t packed_row_bytes = (3 * width + 1) / 2;
+    for (size_t y = 0; y < height; ++y) {
+        uint16_t* out = (uint16_t*)dst + y * width;
+        const uint8_t* in = (const uint8_t*)src + y * src_pitch;
+        // Vectors may read into the next row, but not past the last one.
+        const size_t readable =
+          y + 1 < height ? src_pitch + packed_row_bytes : packed_row_bytes;
+        size_t x = unpack_mono12p_row(out, in, width, readable);
+        for (; x < width; ++x) {
+            const uint8_t* p = in + x / 2 * 3;
+            out[x] = (x & 1) ? (uint16_t)((p[1] >> 4) | (p[2] << 4))
+                             : (uint16_t)(p[0] | ((p[1] & 0x0f) << 8));
+        }
+    }
+}
+
+void
+shift_u16_to_u8_rows(void* dst,
+                     const void* src,
+                     size_t width,
+                     size_t src_pitch,
+                     size_t height,
+                     uint8_t shift)
+{
+    for (size_t y = 0; y < height; ++y) {
+        uint8_t* out = (uint8_t*)dst + y * width;
+        const uint16_t* in =
+          (const uint16_t*)((const uint8_t*)src + y * src_pitch);
+        size_t x = shift_u16_to_u8_row(out, in, width, shift);
+        for (; x < width; ++x) {
+            const unsigned v = (unsigned)in[x] >> shift;
+            out[x] = (uint8_t)(v < 255 ? v : 255);
+        }
+    }
+}
+
+static uint8_t
+window_one(uint16_t v, uint16_t black, uint16_t range, float scale)
+{
+    unsigned d = v > black ? (unsigned)(v - black) : 0;
+    d = d < range ? d : range;
+    return (uint8_t)(int)((float)d * scale + 0.5f);
+}
+
+void
+window_u16_to_u8_rows(void* dst,
+                      const void* src,
+                      size_t width,
+                      size_t src_pitch,
+                      size_t height,
+                      uint16_t black,
+                      uint16_t white)
+{
+    const uint16_t range = (uint16_t)(white - black);
+    const float scale = 255.0f / (float)range;
+    for (size_t y = 0; y < height; ++y) {
+        uint8_t* out = (uint8_t*)dst + y * width;
+        const uint16_t* in =
+          (const uint16_t*)((const uint8_t*)src + y * src_pitch);
+        size_t x = window_u16_to_u8_row(out, in, width, black, range, scale);
+        for (; x < width; ++x)
+            out[x] = window_one(in[x], black, range, scale);
+    }
+}
+
+size_t
+binned_size(size_t n, size_t bin, size_t step)
+{
+    return n < bin ? 0 : (n - bin) / (bin * step) + 1;
+}
+
+void
+bin_rows(void* dst,
+         const void* src,
+         size_t width,
+         size_t src_pitch,
+         size_t height,
+         size_t bytes_per_pixel,
+         const struct binning* binning,
+         uint32_t* acc)
+{
+    const struct binning* b = binning;
+    const size_t out_width = binned_size(width, b->bin_x, b->step_x);
+    const size_t out_height = binned_size(height, b->bin_y, b->step_y);
+    // Only the columns of kept blocks are needed.
+    const size_t used = out_width ? (out_width - 1) * b->bin_x * b->step_x +
+                                      b->bin_x
+                                  : 0;
+    const uint32_t n = (uint32_t)(b->bin_x * b->bin_y);
+    const uint32_t max = bytes_per_pixel == 1 ? UINT8_MAX : UINT16_MAX;
+
+    for (size_t oy = 0; oy < out_height; ++oy) {
+        // Sum the block's rows column by column. Skipped rows are never
+        // read.
+        memset(acc, 0, used * sizeof(*acc));
+        const size_t y0 = oy * b->bin_y * b->step_y;
+        for (size_t y = y0; y < y0 + b->bin_y; ++y) {
+            const uint8_t* row = (const uint8_t*)src + y * src_pitch;
+            size_t x;
+            if (bytes_per_pixel == 1) {
+                x = accumulate_u8_row(acc, row, used);
+                for (; x < used; ++x)
+                    acc[x] += row[x];
+            } else {
+                const uint16_t* row16 = (const uint16_t*)row;
+                x = accumulate_u16_row(acc, row16, used);
+                for (; x < used; ++x)
+                    acc[x] += row16[x];
+            }
+        }
+
+        // Then across each block.
+        for (size_t ox = 0; ox < out_width; ++ox) {
+            const uint32_t* a = acc + ox * b->bin_x * b->step_x;
+            uint32_t sum = 0;
+            for (size_t i = 0; i < b->bin_x; ++i)
+                sum += a[i];
+            if (b->is_mean)
+                sum = (sum + n / 2) / n;
+            if (sum > max)
+                sum = max;
+            if (bytes_per_pixel == 1)
+                ((uint8_t*)dst)[oy * out_width + ox] = (uint8_t)sum;
+            else
+                ((uint16_t*)dst)[oy * out_width + ox] = (uint16_t)sum;
+        }
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef H_ACQUIRE_DCAM_COPY_V0
+#define H_ACQUIRE_DCAM_COPY_V0
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /// @brief Copies `height` rows of `row_bytes` each into `dst`, dropping
+    ///        the padding at the end of each source row.
+    /// @details Rows in `src` start `src_pitch` bytes apart. Rows in `dst`
+    ///          are packed tightly. When the source has no padding, the
+    ///          frame is copied as one contiguous block.
+    void copy_packed_rows(void* dst,
+                          const void* src,
+                          size_t row_bytes,
+                          size_t src_pitch,
+                          size_t height);
+
+    /// @brief Unpacks `height` rows of `width` 12-bit pixels into `dst` at
+    ///        16 bits per pixel.
+    /// @details The source is DCAM_PIXELTYPE_MONO12P: each pair of pixels is
+    ///          packed into three bytes, least significant bits first, so
+    ///          the first pixel takes byte 0 and the low nibble of byte 1.
+    ///          Rows in `src` start `src_pitch` bytes apart. Rows in `dst`
+    ///          are packed tightly.
+    void unpack_mono12p_rows(void* dst,
+                             const void* src,
+                             size_t width,
+                             size_t src_pitch,
+                             size_t height);
+
+    /// @brief Converts `height` rows of `width` 16-bit pixels to 8 bits by
+    ///        shifting each right by `shift` bits, saturating at 255.
+    /// @details Rows in `src` start `src_pitch` bytes apart. Rows in `dst`
+    ///          are packed tightly.
+    void shift_u16_to_u8_rows(void* dst,
+                              const void* src,
+                              size_t width,
+                              size_t src_pitch,
+                              size_t height,
+                              uint8_t shift);
+
+    /// @brief Converts `height` rows of `width` 16-bit pixels to 8 bits by
+    ///        mapping [`black`, `white`] linearly onto [0, 255].
+    /// @details Pixels outside the window are clamped to it. Rows in `src`
+    ///          start `src_pitch` bytes apart. Rows in `dst` are packed
+    ///          tightly. `white` must be greater than `black`.
+    void window_u16_to_u8_rows(void* dst,
+                               const void* src,
+                               size_t width,
+                               size_t src_pitch,
+                               size_t height,
+                               uint16_t black,
+                               uint16_t white);
+
+    /// Software binning and decimation. Each output pixel combines a
+    /// `bin_x` by `bin_y` block of input pixels. Only every `step_x`-th
+    /// block across and `step_y`-th block down is kept.
+    struct binning
+    {
+        size_t bin_x, bin_y;
+        size_t step_x, step_y;
+        int is_mean; // average the block instead of summing it
+    };
+
+    /// @brief Number of output pixels along an axis with `n` input pixels.
+    size_t binned_size(size_t n, size_t bin, size_t step);
+
+    /// @brief Bins and decimates `height` rows of `width` pixels into `dst`.
+    /// @details Pixels are `bytes_per_pixel` (1 or 2) bytes wide, and sums
+    ///          saturate at the largest value that fits. Rows in `src`
+    ///          start `src_pitch` bytes apart. Rows in `dst` are packed
+    ///          tightly. `acc` is scratch space for `width` sums.
+    void bin_rows(void* dst,
+                  const void* src,
+                  size_t width,
+                  size_t src_pitch,
+                  size_t height,
+                  size_t bytes_per_pixel,
+                  const struct binning* binning,
+                  uint32_t* acc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // H_ACQUIRE_DCAM_COPY_V0
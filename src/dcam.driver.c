@@ -1,5 +1,6 @@
 #include "dcam.camera.h"
 #include "dcam.error.h"
+#include "dcam.getset.h"
 #include "dcam.prelude.h"
 
 #include "device/kit/driver.h"
@@ -8,21 +9,90 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <dcamapi4.h>
 
 #define countof(e) (sizeof(e) / sizeof(*(e)))
 #define containerof(P, T, F) ((T*)(((char*)(P)) - offsetof(T, F)))
 
+// First wait between attempts to restart DCAM. Doubles after each failure.
+#define RECOVERY_FIRST_BACKOFF_MS 20.0f
+
 enum DeviceStatusCode
 aq_dcam_set__inner(struct Dcam4Camera* self,
                    struct CameraProperties* props,
                    int force);
 
+void
+aq_dcam_forget_ring__inner(struct Dcam4Camera* self);
+
+/// Grows the camera table to a slot for each device DCAM reports. Cameras
+/// already open keep their slots, even if DCAM now reports fewer devices.
+static int
+fit_camera_table(struct Dcam4Driver* self)
+{
+    const uint32_t n = self->api_init.iDeviceCount;
+    if (n <= self->camera_capacity)
+        return 1;
+    struct Dcam4Camera** cameras = 0;
+    struct DeviceIdentifier* identifiers = 0;
+    CHECK(cameras = (struct Dcam4Camera**)realloc(self->cameras,
+                                                  n * sizeof(*cameras)));
+    self->cameras = cameras;
+    CHECK(identifiers = (struct DeviceIdentifier*)realloc(
+            self->identifiers, n * sizeof(*identifiers)));
+    self->identifiers = identifiers;
+    memset(cameras + self->camera_capacity,
+           0,
+           (n - self->camera_capacity) * sizeof(*cameras));
+    memset(identifiers + self->camera_capacity,
+           0,
+           (n - self->camera_capacity) * sizeof(*identifiers));
+    self->camera_capacity = n;
+    return 1;
+Error:
+    return 0;
+}
+
+/// Initializes DCAM, if it isn't already, and sizes the camera table for
+/// the devices it finds. This waits until the driver is first used rather
+/// than when it's loaded, though listing devices is such a use.
+/// A failure is remembered, so the slow init isn't repeated on every call.
+/// Must be called with the driver lock held.
+static int
+init_api__locked(struct Dcam4Driver* self)
+{
+    if (self->is_api_initialized)
+        return 1;
+    if (self->is_api_unavailable)
+        return 0;
+    self->api_init = (DCAMAPI_INIT){ .size = sizeof(DCAMAPI_INIT) };
+    const DCAMERR ecode = DCALL(dcamapi_init(&self->api_init));
+    if (DISFAIL(ecode)) {
+        if (ecode != DCAMERR_NOCAMERA)
+            LOG("Warning: DCAMAPI failed to initialize.");
+        DWRN(dcamapi_uninit());
+        self->api_init.iDeviceCount = 0;
+        self->is_api_unavailable = 1;
+        return 0;
+    }
+    self->is_api_initialized = 1;
+    EXPECT(fit_camera_table(self),
+           "Failed to allocate a table for %d cameras.",
+           self->api_init.iDeviceCount);
+    return 1;
+Error:
+    return 0;
+}
+
 static uint32_t
 aq_dcam_device_count(struct Driver* self_)
 {
     struct Dcam4Driver* self = containerof(self_, struct Dcam4Driver, driver);
-    const uint32_t n = self->api_init.iDeviceCount;
+    lock_acquire(&self->lock);
+    const uint32_t n =
+      init_api__locked(self) ? self->api_init.iDeviceCount : 0;
+    lock_release(&self->lock);
     return n;
 }
 
@@ -65,7 +135,16 @@ aq_dcam_describe(const struct Driver* self_,
 
     struct Dcam4Driver* self = containerof(self_, struct Dcam4Driver, driver);
     lock_acquire(&self->lock);
-    CHECK(Device_Ok == aq_dcam_describe__inner(self, ident, i));
+    CHECK(init_api__locked(self));
+    CHECK(i < self->camera_capacity);
+    // Identifiers don't change while DCAM is up, so each device is only
+    // asked once.
+    if (self->identifiers[i].kind == DeviceKind_None) {
+        struct DeviceIdentifier described = { 0 };
+        CHECK(Device_Ok == aq_dcam_describe__inner(self, &described, i));
+        self->identifiers[i] = described;
+    }
+    *ident = self->identifiers[i];
     lock_release(&self->lock);
     return Device_Ok;
 Error:
@@ -96,9 +175,16 @@ aq_dcam_open__inner(struct Dcam4Driver* driver,
         hwait = p.hwait;
     }
 
+    // The device identity, driver options, the trigger schedule and frame
+    // counters outlive the DCAM handles, so they survive a reset.
+    const struct Dcam4Options options = out->options;
+    const struct Dcam4TriggerSchedule schedule = out->trigger.schedule;
+    const struct Dcam4Status status = { .frames = out->status.frames,
+                                        .recovery = out->status.recovery };
     *out = (struct Dcam4Camera){
         .camera =
-          (struct Camera){ .state = DeviceState_AwaitingConfiguration,
+          (struct Camera){ .device = out->camera.device,
+                           .state = DeviceState_AwaitingConfiguration,
                            .set = aq_dcam_set,
                            .get = aq_dcam_get,
                            .get_meta = aq_dcam_get_metadata,
@@ -107,8 +193,12 @@ aq_dcam_open__inner(struct Dcam4Driver* driver,
                            .stop = aq_dcam_stop,
                            .execute_trigger = aq_dcam_fire_software_trigger,
                            .get_frame = aq_dcam_get_frame },
+        .driver = driver,
         .hdcam = hdcam,
         .wait = hwait,
+        .options = options,
+        .status = status,
+        .trigger = { .schedule = schedule },
     };
     aq_dcam_get(&out->camera, &out->last_props);
     TRACE("DCAM device id: %d\tdcam: %p\thwait: %p",
@@ -124,20 +214,31 @@ static enum DeviceStatusCode
 aq_dcam_open(struct Driver* self_, uint64_t device_id, struct Device** out)
 {
     struct Dcam4Camera* camera = 0;
+    struct Dcam4Driver* driver = 0;
     CHECK(out);
     *out = 0;
     CHECK(self_);
-    struct Dcam4Driver* driver = containerof(self_, struct Dcam4Driver, driver);
-    CHECK(device_id < countof(driver->cameras));
+    driver = containerof(self_, struct Dcam4Driver, driver);
+    lock_acquire(&driver->lock);
+    CHECK(init_api__locked(driver));
+    EXPECT(device_id < driver->camera_capacity,
+           "Device id %llu is out of range. DCAM reported %u devices.",
+           (unsigned long long)device_id,
+           (unsigned)driver->api_init.iDeviceCount);
     CHECK(camera = (struct Dcam4Camera*)malloc(sizeof(struct Dcam4Camera)));
+    memset(camera, 0, sizeof(*camera));
+    aq_dcam_default_options(&camera->options);
     lock_init(&camera->lock);
     CHECK(Device_Ok == aq_dcam_open__inner(driver, device_id, camera));
     driver->cameras[device_id] = camera;
+    lock_release(&driver->lock);
     *out = &camera->camera.device;
     return Device_Ok;
 Error:
     if (camera)
         free(camera);
+    if (driver)
+        lock_release(&driver->lock);
     return Device_Err;
 }
 
@@ -146,7 +247,14 @@ aq_dcam_close__inner(struct Dcam4Driver* driver, struct Dcam4Camera* self)
 {
 
     DWRN(dcamwait_close(self->wait));
+    array_prop_forget(self->hdcam);
     DWRN(dcamdev_close(self->hdcam));
+    // Closing the device releases its buffers, so the ring can go.
+    aq_dcam_forget_ring__inner(self);
+    free(self->scratch);
+    self->scratch = 0;
+    self->scratch_bytes = 0;
+    frame_queue_destroy(&self->capture.queue);
 
     self->camera.state = DeviceState_Closed;
 }
@@ -168,6 +276,7 @@ aq_dcam_close(struct Driver* driver, struct Device* in)
     lock_release(&self->lock);
 
     lock_release(&dcam_driver->lock);
+    free((void*)self->trigger.schedule.times_ms);
     free(self);
     return Device_Ok;
 }
@@ -178,13 +287,17 @@ aq_dcam_shutdown_(struct Driver* self_)
     CHECK(self_);
     struct Dcam4Driver* self = containerof(self_, struct Dcam4Driver, driver);
     lock_acquire(&self->lock);
-    for (int i = 0; i < countof(self->cameras); ++i) {
+    for (uint32_t i = 0; i < self->camera_capacity; ++i) {
         if (self->cameras[i])
             camera_close(&self->cameras[i]->camera);
     }
-    DWRN(dcamapi_uninit());
+    if (self->is_api_initialized)
+        DWRN(dcamapi_uninit());
     lock_release(&self->lock);
+    dcam_stats_shutdown();
 
+    free(self->cameras);
+    free(self->identifiers);
     memset(self, 0, sizeof(*self));
     free(self);
 
@@ -193,148 +306,184 @@ Error:
     return Device_Err;
 }
 
-// forward declarations for reset_driver_and_replace_camera()
+/// Applies `props` to a camera that was just reopened, and arms it if they
+/// were accepted. Must be called with the driver lock held.
+static void
+reconfigure__locked(struct Dcam4Camera* self, struct CameraProperties* props)
+{
+    self->camera.state = Device_Ok == aq_dcam_set__inner(self, props, 1)
+                           ? DeviceState_Armed
+                           : DeviceState_AwaitingConfiguration;
+}
 
-// FIXME: (nclack) Manual maint of ABI compatibility required. see loader.c
-struct Loader
+/// Closes and reopens the DCAM device behind `self` alone, then restores its
+/// last properties. Other cameras are left running.
+/// Must be called with the driver lock held and capture stopped.
+static int
+reopen_camera__locked(struct Dcam4Driver* driver, struct Dcam4Camera* self)
 {
-    struct Driver driver;
-    struct Driver* inner;
-    HMODULE hmodule;
-};
-
-// static enum DeviceStatusCode
-// aq_dcam_open__inner(struct Dcam4Driver* driver,
-//                     uint64_t device_id,
-//                     struct Dcam4Camera* out);
-// static enum DeviceStatusCode
-// aq_dcam_describe(const struct Driver* self_,
-//                  struct DeviceIdentifier* ident,
-//                  uint64_t i);
-// static void
-// aq_dcam_close__inner(struct Dcam4Driver* driver, struct Dcam4Camera* self);
-// static enum DeviceStatusCode
-// aq_dcam_describe__inner(const struct Dcam4Driver* self,
-//                         struct DeviceIdentifier* ident,
-//                         uint64_t i);
-
-/// @brief Attempt to reset the driver and re-initialize the camera.
-/// @note This only gets called after there's been a problem with a camera.
-///       Other cameras might still be live.
-struct Dcam4Camera*
-reset_driver_and_replace_camera(struct Dcam4Camera* self)
+    const uint8_t device_id = self->camera.device.identifier.device_id;
+    struct CameraProperties props = self->last_props;
+    aq_dcam_close__inner(driver, self);
+    CHECK(Device_Ok == aq_dcam_open__inner(driver, device_id, self));
+    reconfigure__locked(self, &props);
+    return 1;
+Error:
+    return 0;
+}
+
+/// Restarts the DCAM API, retrying with exponential backoff until the
+/// deadline in `options` passes. Counts each try in `attempts`.
+static int
+restart_api__locked(struct Dcam4Driver* driver,
+                    const struct Dcam4Options* options,
+                    uint32_t* attempts)
 {
-    uint8_t driver_mutex_acquired = 0;
-    CHECK(self);
-    // Get the driver pointer
-    // FIXME: (nclack) GROSS - This depends on ABI compatibility with the
-    //        Loader struct which isn't strictly constrained.
-
-    struct Loader* loader =
-      containerof(self->camera.device.driver, struct Loader, driver);
-    struct Dcam4Driver* driver =
-      containerof(loader->inner, struct Dcam4Driver, driver);
-    size_t ncameras =
-      min(driver->api_init.iDeviceCount, countof(driver->cameras));
-    char self_name[256] = { 0 };
-    memcpy(self_name,
-           self->camera.device.identifier.name,
-           strlen(self->camera.device.identifier.name));
-
-    // try to stop all the associated cameras
-    for (int i = 0; i < ncameras; ++i) {
-        CHECK(Device_Ok == camera_stop(&driver->cameras[i]->camera));
-    }
+    struct clock deadline;
+    clock_init(&deadline);
+    clock_shift_ms(&deadline, options->recovery_deadline_ms);
+    float backoff_ms = RECOVERY_FIRST_BACKOFF_MS;
+    while (1) {
+        ++*attempts;
+        driver->api_init = (DCAMAPI_INIT){ .size = sizeof(DCAMAPI_INIT) };
+        const DCAMERR ecode = DCALL(dcamapi_init(&driver->api_init));
+        if (!DISFAIL(ecode))
+            return 1;
+        DWRN(dcamapi_uninit());
 
-    // save properties
-    struct CameraProperties saved_props[countof(driver->cameras)] = { 0 };
-    for (int device_idx = 0; device_idx < ncameras; ++device_idx) {
-        struct Dcam4Camera* cam = driver->cameras[device_idx];
-        if (cam) // camera is opened
-            saved_props[device_idx] = cam->last_props;
+        const double remaining_ms = -clock_toc_ms(&deadline);
+        EXPECT(remaining_ms > 0.0,
+               "Failed to restart DCAM after %u attempts. %s",
+               *attempts,
+               dcam_error_to_string(ecode));
+        const double wait_ms =
+          backoff_ms < remaining_ms ? backoff_ms : remaining_ms;
+        LOG("Failed to restart DCAM. %s Retrying in %.0f ms.",
+            dcam_error_to_string(ecode),
+            wait_ms);
+        clock_sleep_ms(0, wait_ms);
+        backoff_ms *= 2.0f;
+        if (backoff_ms > options->recovery_max_backoff_ms)
+            backoff_ms = options->recovery_max_backoff_ms;
     }
+Error:
+    return 0;
+}
 
-    // close and shutdown
+/// Stops and closes every open camera, restarts the DCAM API, then reopens
+/// them and restores their last properties.
+/// Fails if `self` could not be reopened, e.g. because it's gone.
+/// Must be called with the driver lock held, and no camera lock.
+static int
+reset_api__locked(struct Dcam4Driver* driver,
+                  struct Dcam4Camera* self,
+                  const struct Dcam4Options* options,
+                  uint32_t* attempts)
+{
+    size_t ncameras = driver->camera_capacity;
+    struct CameraProperties* saved_props = 0;
+    CHECK(saved_props = (struct CameraProperties*)calloc(
+            ncameras, sizeof(struct CameraProperties)));
 
     LOG("Shutting down the driver");
-    lock_acquire(&driver->lock);
-    driver_mutex_acquired = 1;
-    {
-        for (int i = 0; i < ncameras; ++i) {
-            if (driver->cameras[i])
-                aq_dcam_close__inner(driver, driver->cameras[i]);
+    for (size_t i = 0; i < ncameras; ++i) {
+        struct Dcam4Camera* cam = driver->cameras[i];
+        if (!cam)
+            continue;
+        saved_props[i] = cam->last_props;
+        // Already closed if reopening it alone failed.
+        if (cam->camera.state != DeviceState_Closed) {
+            WARN(Device_Ok == camera_stop(&cam->camera));
+            aq_dcam_close__inner(driver, cam);
         }
-        DWRN(dcamapi_uninit());
-        driver->api_init = (DCAMAPI_INIT){ 0 };
     }
-
-    // reinitialize the driver
+    DWRN(dcamapi_uninit());
+    driver->api_init = (DCAMAPI_INIT){ 0 };
+    driver->is_api_initialized = 0;
+    // Devices may be enumerated in a different order after the restart.
+    memset(driver->identifiers,
+           0,
+           driver->camera_capacity * sizeof(*driver->identifiers));
+
+    CHECK(restart_api__locked(driver, options, attempts));
+    driver->is_api_initialized = 1;
+    driver->is_api_unavailable = 0;
+    CHECK(fit_camera_table(driver));
     {
-        int retries = 10;
-        while (retries-- > 0) {
-            const float dt_ms = 10000.0f;
-            LOG("Waiting %3.1f sec before attempting to restart DCAM (%d "
-                "remaining attempts).",
-                dt_ms * 1e-3f,
-                retries);
-            clock_sleep_ms(0, 10000);
-
-            LOG("Attempting DCAM restart...");
-            driver->api_init = (DCAMAPI_INIT){ .size = sizeof(DCAMAPI_INIT) };
-            {
-                DCAMERR ecode = dcamapi_init(&driver->api_init);
-                if (!DISFAIL(ecode))
-                    break;
-                LOG("Failed to restart DCAM. %s", dcam_error_to_string(ecode));
-            }
-            DWRN(dcamapi_uninit());
-        }
-        CHECK(retries > 0);
+        const int32 count = driver->api_init.iDeviceCount;
+        const size_t ndevices = count > 0 ? (size_t)count : 0;
+        if (ndevices < ncameras)
+            ncameras = ndevices;
     }
-    ncameras = min(driver->api_init.iDeviceCount, countof(driver->cameras));
 
     // reopen all cameras and reset their properties
-    for (int32_t device_id = 0; device_id < ncameras; ++device_id) {
-        if (driver->cameras[device_id]) { // camera was previously opened
-            CHECK(Device_Ok == aq_dcam_open__inner(driver,
-                                                   device_id,
-                                                   driver->cameras[device_id]));
-            driver->cameras[device_id]->camera.device.driver = &loader->driver;
-            CHECK(Device_Ok ==
-                  aq_dcam_describe__inner(
-                    driver,
-                    &driver->cameras[device_id]->camera.device.identifier,
-                    device_id));
-
-            switch (aq_dcam_set__inner(driver->cameras[device_id],
-                                       &saved_props[device_id],
-                                       1 /*?force*/)) {
-                case Device_Ok:
-                    driver->cameras[device_id]->camera.state =
-                      DeviceState_Armed;
-                    break;
-                case Device_Err:
-                    driver->cameras[device_id]->camera.state =
-                      DeviceState_AwaitingConfiguration;
-                    break;
-            }
-        }
+    for (uint32_t device_id = 0; device_id < ncameras; ++device_id) {
+        struct Dcam4Camera* cam = driver->cameras[device_id];
+        if (!cam) // camera wasn't opened
+            continue;
+        CHECK(Device_Ok == aq_dcam_open__inner(driver, device_id, cam));
+        CHECK(Device_Ok ==
+              aq_dcam_describe__inner(
+                driver, &cam->camera.device.identifier, device_id));
+        driver->identifiers[device_id] = cam->camera.device.identifier;
+        reconfigure__locked(cam, &saved_props[device_id]);
     }
+    EXPECT(self->camera.state != DeviceState_Closed,
+           "%s is no longer present after restarting DCAM.",
+           self->camera.device.identifier.name);
+    free(saved_props);
+    return 1;
+Error:
+    free(saved_props);
+    return 0;
+}
 
-    // find the camera with the matching name
-    for (uint32_t i = 0; i < ncameras; ++i) {
-        if (0 == strncmp(self_name,
-                         driver->cameras[i]->camera.device.identifier.name,
-                         sizeof(self_name))) {
-            *self = *driver->cameras[i];
-            break;
-        }
+/// @brief Attempt to recover a camera after DCAM failed it.
+/// @details Reopens just this camera when `may_reopen` is set, so other
+///          cameras keep running. If that fails, or isn't allowed, every
+///          camera is closed and the DCAM API restarted.
+/// @note Must be called without the camera lock.
+/// @returns 1 if the camera was reopened, otherwise 0.
+int
+aq_dcam_recover(struct Dcam4Camera* self, int may_reopen)
+{
+    CHECK(self);
+    struct Dcam4Driver* driver = self->driver;
+    const struct Dcam4Options options = self->options;
+    struct clock started;
+    clock_init(&started);
+    uint32_t attempts = 0;
+    int is_ok = 0, is_reset = 0;
+    WARN(Device_Ok == aq_dcam_stop(&self->camera));
+
+    lock_acquire(&driver->lock);
+    if (may_reopen) {
+        LOG("Reopening %s", self->camera.device.identifier.name);
+        is_ok = reopen_camera__locked(driver, self);
+    }
+    if (!is_ok) {
+        is_reset = 1;
+        is_ok = reset_api__locked(driver, self, &options, &attempts);
     }
     lock_release(&driver->lock);
-    return self;
+
+    const float elapsed_ms = (float)clock_toc_ms(&started);
+    LOG("%s %s in %.1f ms (%u attempts to restart DCAM).",
+        is_ok ? "Recovered" : "Failed to recover",
+        self->camera.device.identifier.name,
+        elapsed_ms,
+        attempts);
+    lock_acquire(&self->lock);
+    ++self->status.recovery.count;
+    self->status.recovery.resets += is_reset;
+    self->status.recovery.failed += !is_ok;
+    self->status.recovery.last_attempts = attempts;
+    self->status.recovery.last_ms = elapsed_ms;
+    if (elapsed_ms > self->status.recovery.max_ms)
+        self->status.recovery.max_ms = elapsed_ms;
+    lock_release(&self->lock);
+    return is_ok;
 Error:
-    if (driver_mutex_acquired)
-        lock_release(&driver->lock);
     return 0;
 }
 
@@ -353,25 +502,9 @@ acquire_driver_init_v0(acquire_reporter_t reporter)
           .shutdown = aq_dcam_shutdown_, },
     };
     lock_init(&self->lock);
-
-    self->api_init.size = sizeof(self->api_init);
-
-    {
-        DCAMERR dcam_init_result = dcamapi_init(&self->api_init);
-        if (dcam_init_result == DCAMERR_NOCAMERA) {
-            free(self);
-            return 0;
-        }
-
-        if (DISFAIL(dcam_init_result)) {
-            free(self);
-            LOG("Warning: DCAMAPI failed to initialize.");
-            return 0;
-        }
-    }
-
+    array_prop_cache_init();
+    dcam_stats_init();
     return &self->driver;
 Error:
-    DWRN(dcamapi_uninit());
     return 0;
 }
@@ -1,5 +1,7 @@
 #include "dcam.error.h"
 
+DCAM_THREAD_LOCAL uint64_t dcam_call_count = 0;
+
 const char*
 dcam_error_to_string(DCAMERR error_code)
 {
@@ -2,8 +2,17 @@
 #define H_ACQUIRE_DCAM_CAMERA_V0
 
 #include <stddef.h>
+#include <stdint.h>
 #include <dcamapi4.h>
 
+#if defined(_MSC_VER)
+#define DCAM_THREAD_LOCAL __declspec(thread)
+#elif defined(__cplusplus)
+#define DCAM_THREAD_LOCAL thread_local
+#else
+#define DCAM_THREAD_LOCAL _Thread_local
+#endif
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -11,6 +20,11 @@ extern "C"
 
     const char* dcam_error_to_string(DCAMERR error_code);
 
+    /// Calls the current thread has made into DCAM through DCALL(), DCAM()
+    /// or DWRN(). The difference between two reads counts the calls made in
+    /// between.
+    extern DCAM_THREAD_LOCAL uint64_t dcam_call_count;
+
 #ifdef __cplusplus
 }
 #endif
@@ -3,6 +3,97 @@
 #include "dcam.error.h"
 
 #include "logger.h"
+#include "platform.h"
+
+#define countof(e) (sizeof(e) / sizeof((e)[0]))
+
+// The element layout of array properties is fixed for a device, so it's
+// fetched once per property and device handle. Entries are dropped when the
+// device is closed, since the handle may be reused. When the table is full,
+// layouts are fetched on every access.
+static struct
+{
+    struct lock lock;
+    struct array_prop_layout
+    {
+        HDCAM h;
+        int32 prop_id;
+        int32 base, step;
+    } entries[64];
+    size_t count;
+} array_props;
+
+void
+array_prop_cache_init(void)
+{
+    lock_init(&array_props.lock);
+}
+
+void
+array_prop_forget(HDCAM h)
+{
+    lock_acquire(&array_props.lock);
+    size_t n = 0;
+    for (size_t i = 0; i < array_props.count; ++i) {
+        if (array_props.entries[i].h != h)
+            array_props.entries[n++] = array_props.entries[i];
+    }
+    array_props.count = n;
+    lock_release(&array_props.lock);
+}
+
+static struct array_prop_layout*
+find_array_prop_layout__locked(HDCAM h, int32_t prop_id)
+{
+    for (size_t i = 0; i < array_props.count; ++i) {
+        struct array_prop_layout* e = array_props.entries + i;
+        if (e->h == h && e->prop_id == prop_id)
+            return e;
+    }
+    return 0;
+}
+
+/// Finds where the elements of array property `prop_id` are: element `i` is
+/// property `base + i * step`.
+static int
+get_array_prop_layout(HDCAM h, int32_t prop_id, int32* base, int32* step)
+{
+    {
+        lock_acquire(&array_props.lock);
+        const struct array_prop_layout* e =
+          find_array_prop_layout__locked(h, prop_id);
+        if (e) {
+            *base = e->base;
+            *step = e->step;
+        }
+        lock_release(&array_props.lock);
+        if (e)
+            return 1;
+    }
+
+    DCAMPROP_ATTR attr = {
+        .cbSize = sizeof(attr),
+        .iProp = prop_id,
+    };
+    DCAM(dcamprop_getattr(h, &attr));
+    *base = attr.iProp_ArrayBase;
+    *step = attr.iPropStep_Element;
+
+    lock_acquire(&array_props.lock);
+    if (!find_array_prop_layout__locked(h, prop_id) &&
+        array_props.count < countof(array_props.entries)) {
+        array_props.entries[array_props.count++] = (struct array_prop_layout){
+            .h = h,
+            .prop_id = prop_id,
+            .base = *base,
+            .step = *step,
+        };
+    }
+    lock_release(&array_props.lock);
+    return 1;
+Error:
+    return 0;
+}
 
 int
 prop_read_i32(HDCAM h, int32_t prop_id, int32_t* out, const char* prop_name)
@@ -119,15 +210,7 @@ array_prop_read_i32(HDCAM h,
                     const char* prop_name)
 {
     int32 base, step;
-    {
-        DCAMPROP_ATTR attr = {
-            .cbSize = sizeof(attr),
-            .iProp = prop_id,
-        };
-        DCAM(dcamprop_getattr(h, &attr));
-        base = attr.iProp_ArrayBase;
-        step = attr.iPropStep_Element;
-    }
+    CHECK(get_array_prop_layout(h, prop_id, &base, &step));
     CHECK(prop_read_i32(h, base + index * step, out, prop_name));
     return 1;
 Error:
@@ -143,15 +226,7 @@ array_prop_rw_i32(HDCAM h,
                   const char* prop_name)
 {
     int32 base, step;
-    {
-        DCAMPROP_ATTR attr = {
-            .cbSize = sizeof(attr),
-            .iProp = prop_id,
-        };
-        DCAM(dcamprop_getattr(h, &attr));
-        base = attr.iProp_ArrayBase;
-        step = attr.iPropStep_Element;
-    }
+    CHECK(get_array_prop_layout(h, prop_id, &base, &step));
     CHECK(prop_write_i32(h, base + index * step, value, prop_name));
     return 1;
 Error:
@@ -177,15 +252,7 @@ array_prop_read_f64(HDCAM h,
                     const char* prop_name)
 {
     int32 base, step;
-    {
-        DCAMPROP_ATTR attr = {
-            .cbSize = sizeof(attr),
-            .iProp = prop_id,
-        };
-        DCAM(dcamprop_getattr(h, &attr));
-        base = attr.iProp_ArrayBase;
-        step = attr.iPropStep_Element;
-    }
+    CHECK(get_array_prop_layout(h, prop_id, &base, &step));
     CHECK(prop_read_f64(h, base + index * step, out, prop_name));
     return 1;
 Error:
@@ -201,15 +268,7 @@ array_prop_write_f64(HDCAM h,
                      const char* prop_name)
 {
     int32 base, step;
-    {
-        DCAMPROP_ATTR attr = {
-            .cbSize = sizeof(attr),
-            .iProp = prop_id,
-        };
-        DCAM(dcamprop_getattr(h, &attr));
-        base = attr.iProp_ArrayBase;
-        step = attr.iPropStep_Element;
-    }
+    CHECK(get_array_prop_layout(h, prop_id, &base, &step));
     CHECK(prop_write_f64(h, base + index * step, value, prop_name));
     return 1;
 Error:
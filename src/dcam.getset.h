@@ -43,6 +43,16 @@ prop_read_f64(HDCAM h, int32_t prop_id, double* out, const char* prop_name);
 int
 prop_write_f64(HDCAM h, int32_t prop_id, double v, const char* prop_name);
 
+/// @brief Prepares the cache of array property layouts used by the
+///        array_prop_* functions. Call once before using them.
+void
+array_prop_cache_init(void);
+
+/// @brief Drops the cached array property layouts for a device that's about
+///        to be closed.
+void
+array_prop_forget(HDCAM h);
+
 int
 array_prop_read_i32(HDCAM h,
                     int32_t prop_id,
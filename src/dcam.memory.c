@@ -0,0 +1,155 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // MAP_ANONYMOUS, MAP_HUGETLB and syscall()
+#endif
+
+#include "dcam.memory.h"
+#include "dcam.prelude.h"
+
+#include "logger.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+#define HUGE_PAGE_BYTES (2ULL << 20)
+
+static size_t
+align_up(size_t n, size_t align)
+{
+    return (n + align - 1) & ~(align - 1);
+}
+
+size_t
+ring_memory_page_size(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+#ifdef _WIN32
+
+static void*
+alloc_pages(size_t bytes, int32_t numa_node, int is_huge)
+{
+    const DWORD node =
+      numa_node < 0 ? NUMA_NO_PREFERRED_NODE : (DWORD)numa_node;
+    // Large pages require SeLockMemoryPrivilege, so this often fails for
+    // regular users.
+    const DWORD flags =
+      MEM_RESERVE | MEM_COMMIT | (is_huge ? MEM_LARGE_PAGES : 0);
+    return VirtualAllocExNuma(
+      GetCurrentProcess(), 0, bytes, flags, PAGE_READWRITE, node);
+}
+
+static void
+free_pages(void* data, size_t bytes)
+{
+    VirtualFree(data, 0, MEM_RELEASE);
+}
+
+#else
+
+static void*
+alloc_pages(size_t bytes, int32_t numa_node, int is_huge)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_HUGETLB
+    if (is_huge)
+        flags |= MAP_HUGETLB;
+#else
+    if (is_huge)
+        return 0;
+#endif
+    void* data = mmap(0, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (data == MAP_FAILED)
+        return 0;
+
+#ifdef __linux__
+    if (numa_node >= 0) {
+        // mbind(MPOL_BIND) without depending on libnuma.
+        const int mpol_bind = 2;
+        unsigned long nodemask[16] = { 0 };
+        const unsigned long bits = 8 * sizeof(*nodemask);
+        if ((unsigned long)numa_node >= bits * 16) {
+            LOG("NUMA node %d is out of range.", numa_node);
+        } else {
+            nodemask[numa_node / bits] = 1UL << (numa_node % bits);
+            if (syscall(SYS_mbind,
+                        data,
+                        bytes,
+                        mpol_bind,
+                        nodemask,
+                        bits * 16,
+                        0)) {
+                LOG("Could not bind ring memory to NUMA node %d.",
+                    numa_node);
+            }
+        }
+    }
+#endif
+    return data;
+}
+
+static void
+free_pages(void* data, size_t bytes)
+{
+    munmap(data, bytes);
+}
+
+#endif
+
+int
+ring_memory_alloc(struct ring_memory* self,
+                  size_t bytes,
+                  int32_t numa_node,
+                  int use_huge_pages)
+{
+    memset(self, 0, sizeof(*self));
+    CHECK(bytes > 0);
+
+    if (use_huge_pages) {
+        const size_t n = align_up(bytes, HUGE_PAGE_BYTES);
+        if ((self->data = alloc_pages(n, numa_node, 1))) {
+            self->bytes = n;
+            self->is_huge = 1;
+        } else {
+            LOG("Huge pages unavailable for the capture ring. Falling back "
+                "to regular pages.");
+        }
+    }
+
+    if (!self->data) {
+        const size_t n = align_up(bytes, ring_memory_page_size());
+        CHECK(self->data = alloc_pages(n, numa_node, 0));
+        self->bytes = n;
+    }
+
+    // Fault the pages in now, on the chosen node, rather than on the first
+    // frame.
+    memset(self->data, 0, self->bytes);
+    return 1;
+Error:
+    memset(self, 0, sizeof(*self));
+    return 0;
+}
+
+void
+ring_memory_free(struct ring_memory* self)
+{
+    if (self->data)
+        free_pages(self->data, self->bytes);
+    memset(self, 0, sizeof(*self));
+}
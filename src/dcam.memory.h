@@ -0,0 +1,42 @@
+#ifndef H_ACQUIRE_DCAM_MEMORY_V0
+#define H_ACQUIRE_DCAM_MEMORY_V0
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /// Memory for a capture ring that's allocated by the driver and
+    /// registered with DCAM via dcambuf_attach().
+    struct ring_memory
+    {
+        void* data;
+        size_t bytes;
+        int is_huge; // backed by large (2 MB) pages
+    };
+
+    /// @brief Size of a regular page of virtual memory.
+    size_t ring_memory_page_size(void);
+
+    /// @brief Allocates `bytes` of page-aligned memory.
+    /// @details When `use_huge_pages` is set, tries to back the allocation
+    ///          with large pages first, and falls back to regular pages if
+    ///          the system has none to spare. When `numa_node` is not
+    ///          negative, the memory is bound to that node. The pages are
+    ///          touched so they're resident before capture starts.
+    /// @returns 1 on success, otherwise 0.
+    int ring_memory_alloc(struct ring_memory* self,
+                          size_t bytes,
+                          int32_t numa_node,
+                          int use_huge_pages);
+
+    void ring_memory_free(struct ring_memory* self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // H_ACQUIRE_DCAM_MEMORY_V0
@@ -21,8 +21,10 @@
 #define EXPECT(e, ...) EXPECT_INNER(, e, goto Error, ERR, __VA_ARGS__)
 #define CHECK(e) EXPECT(e, "Expression was false:\n\t%s\n", #e)
 #define WARN(e) EXPECT_INNER(, e, , LOG, "Expression was false:\n\t%s\n", #e)
+// Evaluates a DCAM call, counting it in dcam_call_count.
+#define DCALL(e) (++dcam_call_count, (e))
 #define DCAM_INNER(e, logger, action)                                          \
-    EXPECT_INNER(DCAMERR result_ = (e),                                        \
+    EXPECT_INNER(DCAMERR result_ = DCALL(e),                                   \
                  !DISFAIL(result_),                                            \
                  action,                                                       \
                  logger,                                                       \
@@ -33,4 +35,29 @@
 #define DCAM(e) DCAM_INNER(e, ERR, goto Error)
 #define DWRN(e) DCAM_INNER(e, LOG, )
 
+// With AQ_DCAM_INSTRUMENT defined, every DCAM call the driver makes is timed
+// and recorded against its camera. See aq_dcam_get_call_stats().
+#ifdef AQ_DCAM_INSTRUMENT
+#include "dcam.stats.h"
+#define dcamdev_open timed_dcamdev_open
+#define dcamdev_close timed_dcamdev_close
+#define dcamdev_getstring timed_dcamdev_getstring
+#define dcamprop_getattr timed_dcamprop_getattr
+#define dcamprop_getvalue timed_dcamprop_getvalue
+#define dcamprop_setvalue timed_dcamprop_setvalue
+#define dcamprop_setgetvalue timed_dcamprop_setgetvalue
+#define dcambuf_alloc timed_dcambuf_alloc
+#define dcambuf_attach timed_dcambuf_attach
+#define dcambuf_release timed_dcambuf_release
+#define dcambuf_lockframe timed_dcambuf_lockframe
+#define dcamcap_start timed_dcamcap_start
+#define dcamcap_stop timed_dcamcap_stop
+#define dcamcap_transferinfo timed_dcamcap_transferinfo
+#define dcamcap_firetrigger timed_dcamcap_firetrigger
+#define dcamwait_open timed_dcamwait_open
+#define dcamwait_close timed_dcamwait_close
+#define dcamwait_start timed_dcamwait_start
+#define dcamwait_abort timed_dcamwait_abort
+#endif
+
 #endif // H_ACQUIRE_DCAM_PRELUDE_V0
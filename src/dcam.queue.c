@@ -0,0 +1,284 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // clock_gettime() and pthread_condattr_setclock()
+#endif
+
+#include "dcam.queue.h"
+#include "dcam.prelude.h"
+
+#include "logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#define CACHE_LINE_BYTES 64
+
+// `head` and `tail` are each written by one thread and read by the other.
+// Loads acquire and stores release, so a slot's contents are visible before
+// the counter that hands it over.
+#ifdef _MSC_VER
+#if defined(_M_IX86) || defined(_M_X64)
+// x86 doesn't reorder loads with loads or stores with stores, so stopping
+// the compiler from reordering is enough.
+#define BARRIER() _ReadWriteBarrier()
+#else
+#define BARRIER() MemoryBarrier()
+#endif
+
+static size_t
+load_acquire(const size_t* p)
+{
+    const size_t v = *(const volatile size_t*)p;
+    BARRIER();
+    return v;
+}
+
+static void
+store_release(size_t* p, size_t v)
+{
+    BARRIER();
+    *(volatile size_t*)p = v;
+}
+
+static int
+load_acquire_int(const int* p)
+{
+    const int v = *(const volatile int*)p;
+    BARRIER();
+    return v;
+}
+
+static void
+store_release_int(int* p, int v)
+{
+    BARRIER();
+    *(volatile int*)p = v;
+}
+#else
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define load_acquire_int load_acquire
+#define store_release_int store_release
+#endif
+
+static size_t
+align_up(size_t n, size_t align)
+{
+    return (n + align - 1) & ~(align - 1);
+}
+
+// Wakes a consumer waiting in frame_queue_wait(). The producer takes the
+// lock after each commit only to notify, and the slots themselves are never
+// accessed under it.
+struct frame_queue_signal
+{
+#ifdef _WIN32
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE cv;
+#else
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+#endif
+    int waiters;
+};
+
+#ifdef _WIN32
+
+static int
+signal_init(struct frame_queue_signal* s)
+{
+    InitializeCriticalSection(&s->lock);
+    InitializeConditionVariable(&s->cv);
+    return 1;
+}
+
+static void
+signal_deinit(struct frame_queue_signal* s)
+{
+    DeleteCriticalSection(&s->lock);
+}
+
+#define signal_lock(s) EnterCriticalSection(&(s)->lock)
+#define signal_unlock(s) LeaveCriticalSection(&(s)->lock)
+#define signal_notify(s) WakeAllConditionVariable(&(s)->cv)
+
+static void
+signal_wait(struct frame_queue_signal* s, double timeout_ms)
+{
+    SleepConditionVariableCS(
+      &s->cv, &s->lock, timeout_ms < 0 ? INFINITE : (DWORD)(timeout_ms + 1));
+}
+
+#else
+
+static int
+signal_init(struct frame_queue_signal* s)
+{
+    pthread_condattr_t attr;
+    CHECK(0 == pthread_mutex_init(&s->lock, 0));
+    CHECK(0 == pthread_condattr_init(&attr));
+    // Timeouts shouldn't move with the wall clock.
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    const int ecode = pthread_cond_init(&s->cv, &attr);
+    pthread_condattr_destroy(&attr);
+    CHECK(0 == ecode);
+    return 1;
+Error:
+    return 0;
+}
+
+static void
+signal_deinit(struct frame_queue_signal* s)
+{
+    pthread_cond_destroy(&s->cv);
+    pthread_mutex_destroy(&s->lock);
+}
+
+#define signal_lock(s) pthread_mutex_lock(&(s)->lock)
+#define signal_unlock(s) pthread_mutex_unlock(&(s)->lock)
+#define signal_notify(s) pthread_cond_broadcast(&(s)->cv)
+
+static void
+signal_wait(struct frame_queue_signal* s, double timeout_ms)
+{
+    if (timeout_ms < 0) {
+        pthread_cond_wait(&s->cv, &s->lock);
+        return;
+    }
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    const long long ns = t.tv_nsec + (long long)(timeout_ms * 1e6);
+    t.tv_sec += (time_t)(ns / 1000000000LL);
+    t.tv_nsec = (long)(ns % 1000000000LL);
+    pthread_cond_timedwait(&s->cv, &s->lock, &t);
+}
+
+#endif
+
+/// Wakes the consumer if it's waiting. Called by the producer.
+static void
+notify(struct frame_queue* self)
+{
+    struct frame_queue_signal* s = self->signal;
+    signal_lock(s);
+    if (s->waiters)
+        signal_notify(s);
+    signal_unlock(s);
+}
+
+int
+frame_queue_init(struct frame_queue* self,
+                 size_t capacity,
+                 size_t slot_bytes)
+{
+    memset(self, 0, sizeof(*self));
+    CHECK(capacity > 0);
+    CHECK(slot_bytes > 0);
+    self->capacity = capacity;
+    self->slot_bytes = align_up(slot_bytes, CACHE_LINE_BYTES);
+
+    // The slots are page-aligned and resident up front, like the capture
+    // ring.
+    EXPECT(ring_memory_alloc(
+             &self->memory, self->capacity * self->slot_bytes, -1, 0),
+           "Failed to allocate a queue of %llu slots of %llu bytes.",
+           (unsigned long long)capacity,
+           (unsigned long long)slot_bytes);
+    self->data = self->memory.data;
+
+    CHECK(self->signal =
+            (struct frame_queue_signal*)calloc(1, sizeof(*self->signal)));
+    if (!signal_init(self->signal)) {
+        free(self->signal);
+        self->signal = 0;
+        goto Error;
+    }
+    return 1;
+Error:
+    ring_memory_free(&self->memory);
+    memset(self, 0, sizeof(*self));
+    return 0;
+}
+
+void
+frame_queue_destroy(struct frame_queue* self)
+{
+    ring_memory_free(&self->memory);
+    if (self->signal) {
+        signal_deinit(self->signal);
+        free(self->signal);
+    }
+    memset(self, 0, sizeof(*self));
+}
+
+void*
+frame_queue_reserve(struct frame_queue* self)
+{
+    const size_t tail = load_acquire(&self->tail);
+    if (self->head - tail >= self->capacity)
+        return 0;
+    return self->data + (self->head % self->capacity) * self->slot_bytes;
+}
+
+void
+frame_queue_commit(struct frame_queue* self)
+{
+    store_release(&self->head, self->head + 1);
+    notify(self);
+}
+
+void
+frame_queue_close(struct frame_queue* self)
+{
+    store_release_int(&self->is_closed, 1);
+    notify(self);
+}
+
+void*
+frame_queue_front(struct frame_queue* self)
+{
+    const size_t head = load_acquire(&self->head);
+    if (head == self->tail)
+        return 0;
+    return self->data + (self->tail % self->capacity) * self->slot_bytes;
+}
+
+void
+frame_queue_wait(struct frame_queue* self, double timeout_ms)
+{
+    struct frame_queue_signal* s = self->signal;
+    signal_lock(s);
+    ++s->waiters;
+    // The producer notifies under the lock after a commit, so one can't
+    // slip in between this check and the wait.
+    if (!frame_queue_front(self) && !frame_queue_is_closed(self))
+        signal_wait(s, timeout_ms);
+    --s->waiters;
+    signal_unlock(s);
+}
+
+void
+frame_queue_pop(struct frame_queue* self)
+{
+    store_release(&self->tail, self->tail + 1);
+}
+
+int
+frame_queue_is_closed(struct frame_queue* self)
+{
+    return load_acquire_int(&self->is_closed);
+}
+
+size_t
+frame_queue_size(struct frame_queue* self)
+{
+    const size_t tail = load_acquire(&self->tail);
+    const size_t head = load_acquire(&self->head);
+    return head - tail;
+}
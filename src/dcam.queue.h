@@ -0,0 +1,86 @@
+#ifndef H_ACQUIRE_DCAM_QUEUE_V0
+#define H_ACQUIRE_DCAM_QUEUE_V0
+
+#include "dcam.memory.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /// A lock-free queue of fixed-size slots for exactly one producer thread
+    /// and one consumer thread.
+    ///
+    /// The producer fills the slot returned by frame_queue_reserve() and
+    /// publishes it with frame_queue_commit(). The consumer reads the slot
+    /// returned by frame_queue_front() and hands it back with
+    /// frame_queue_pop().
+    struct frame_queue
+    {
+        struct ring_memory memory;
+        uint8_t* data;
+        size_t capacity;   // number of slots
+        size_t slot_bytes; // bytes between the starts of consecutive slots
+
+        // Slots ever committed and popped. Only the producer writes `head`
+        // and only the consumer writes `tail`.
+        size_t head, tail;
+
+        // Set by the producer once it won't commit any more slots.
+        int is_closed;
+
+        // Lets the consumer sleep until a slot is committed. See
+        // frame_queue_wait().
+        struct frame_queue_signal* signal;
+    };
+
+    /// @brief Allocates `capacity` slots of at least `slot_bytes` each.
+    /// @details Slots are aligned to a cache line.
+    /// @returns 1 on success, otherwise 0.
+    int frame_queue_init(struct frame_queue* self,
+                         size_t capacity,
+                         size_t slot_bytes);
+
+    /// @brief Frees the slots. Neither end may be in use.
+    void frame_queue_destroy(struct frame_queue* self);
+
+    /// @brief The next slot for the producer to fill, or NULL if the queue
+    ///        is full.
+    void* frame_queue_reserve(struct frame_queue* self);
+
+    /// @brief Makes the slot from frame_queue_reserve() visible to the
+    ///        consumer.
+    void frame_queue_commit(struct frame_queue* self);
+
+    /// @brief Tells the consumer no more slots will be committed.
+    void frame_queue_close(struct frame_queue* self);
+
+    /// @brief The oldest committed slot, or NULL if the queue is empty.
+    void* frame_queue_front(struct frame_queue* self);
+
+    /// @brief Waits until a slot is committed or the queue is closed, for up
+    ///        to `timeout_ms`, or indefinitely if it's negative.
+    /// @details Only for the consumer. May return early, so check
+    ///          frame_queue_front() again after.
+    void frame_queue_wait(struct frame_queue* self, double timeout_ms);
+
+    /// @brief Hands the slot from frame_queue_front() back to the producer.
+    void frame_queue_pop(struct frame_queue* self);
+
+    /// @brief Whether the producer closed the queue. Slots committed before
+    ///        it was closed may still be waiting to be popped.
+    int frame_queue_is_closed(struct frame_queue* self);
+
+    /// @brief Number of committed slots that haven't been popped.
+    /// @details Exact from either end, but may be stale by the time it's
+    ///          read.
+    size_t frame_queue_size(struct frame_queue* self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // H_ACQUIRE_DCAM_QUEUE_V0
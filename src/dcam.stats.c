@@ -0,0 +1,409 @@
+#include "dcam.stats.h"
+
+#include "logger.h"
+#include "platform.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <windows.h>
+#endif
+
+// This file defines the timed stand-ins, so it must not include
+// dcam.prelude.h, which routes the DCAM functions to them.
+#define LOG(...) aq_logger(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+// Handles are published with a release store and read with an acquire load.
+// See dcam.queue.c.
+#ifdef _MSC_VER
+#if defined(_M_IX86) || defined(_M_X64)
+#define BARRIER() _ReadWriteBarrier()
+#else
+#define BARRIER() MemoryBarrier()
+#endif
+
+static void*
+load_acquire_ptr(void* const* p)
+{
+    void* const v = *(void* const volatile*)p;
+    BARRIER();
+    return v;
+}
+
+static void
+store_release_ptr(void** p, void* v)
+{
+    BARRIER();
+    *(void* volatile*)p = v;
+}
+#else
+#define load_acquire_ptr(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release_ptr(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+// Statistics for each open device, keyed by its handles. Each device's
+// calls are recorded under its own lock, so cameras don't wait on each
+// other. Records are only added to the front of the list, and are reused
+// once their device is closed, so the list is searched without a lock.
+// Calls on handles that aren't an open device, like dcamdev_getstring() on
+// a device index, aren't recorded.
+struct device_calls
+{
+    // Written under `stats.lock`, read without it.
+    void* hdcam; // 0 if the record is free
+    void* hwait;
+    void* next; // struct device_calls*
+
+    struct lock lock;
+    struct Dcam4CallStats* calls;
+    uint32_t count, capacity;
+    int is_drop_reported;
+};
+
+static struct
+{
+    struct lock lock; // held to add, claim or free a record
+    void* head;       // struct device_calls*
+} stats;
+
+void
+dcam_stats_init(void)
+{
+    lock_init(&stats.lock);
+}
+
+void
+dcam_stats_shutdown(void)
+{
+    lock_acquire(&stats.lock);
+    struct device_calls* d = (struct device_calls*)stats.head;
+    stats.head = 0;
+    lock_release(&stats.lock);
+    while (d) {
+        struct device_calls* next = (struct device_calls*)d->next;
+        lock_deinit(&d->lock);
+        free(d->calls);
+        free(d);
+        d = next;
+    }
+}
+
+static struct device_calls*
+find_device(HDCAM h)
+{
+    if (!h)
+        return 0;
+    struct device_calls* d =
+      (struct device_calls*)load_acquire_ptr(&stats.head);
+    for (; d; d = (struct device_calls*)load_acquire_ptr(&d->next)) {
+        if (load_acquire_ptr(&d->hdcam) == (void*)h)
+            return d;
+    }
+    return 0;
+}
+
+static struct device_calls*
+find_device_by_wait(HDCAMWAIT w)
+{
+    if (!w)
+        return 0;
+    struct device_calls* d =
+      (struct device_calls*)load_acquire_ptr(&stats.head);
+    for (; d; d = (struct device_calls*)load_acquire_ptr(&d->next)) {
+        if (load_acquire_ptr(&d->hwait) == (void*)w &&
+            load_acquire_ptr(&d->hdcam))
+            return d;
+    }
+    return 0;
+}
+
+static struct Dcam4CallStats*
+find_call__locked(struct device_calls* device,
+                  const char* function,
+                  int32_t prop_id)
+{
+    for (uint32_t i = 0; i < device->count; ++i) {
+        struct Dcam4CallStats* c = device->calls + i;
+        // `function` is always the name of one of the stand-ins below, so
+        // comparing pointers is enough.
+        if (c->function == function && c->prop_id == prop_id)
+            return c;
+    }
+    if (device->count == device->capacity) {
+        const uint32_t capacity = device->capacity ? 2 * device->capacity : 32;
+        struct Dcam4CallStats* calls = (struct Dcam4CallStats*)realloc(
+          device->calls, capacity * sizeof(*calls));
+        if (!calls) {
+            if (!device->is_drop_reported)
+                LOG("Warning: Out of memory for DCAM call statistics. Calls "
+                    "to %s and other new calls won't be recorded.",
+                    function);
+            device->is_drop_reported = 1;
+            return 0;
+        }
+        device->calls = calls;
+        device->capacity = capacity;
+    }
+    struct Dcam4CallStats* c = device->calls + device->count++;
+    memset(c, 0, sizeof(*c));
+    c->function = function;
+    c->prop_id = prop_id;
+    return c;
+}
+
+static uint32_t
+histogram_bucket(uint64_t ns)
+{
+    uint32_t i = 0;
+    while (ns > 1 && i < DCAM_STATS_BUCKETS - 1) {
+        ns >>= 1;
+        ++i;
+    }
+    return i;
+}
+
+static uint64_t
+elapsed_ns(struct clock* started)
+{
+    return (uint64_t)(clock_toc_ms(started) * 1e6);
+}
+
+static void
+record(struct device_calls* device,
+       const char* function,
+       int32_t prop_id,
+       struct clock* started)
+{
+    const uint64_t ns = elapsed_ns(started);
+    if (!device)
+        return;
+    lock_acquire(&device->lock);
+    struct Dcam4CallStats* c = find_call__locked(device, function, prop_id);
+    if (c) {
+        ++c->count;
+        c->total_ns += ns;
+        if (ns > c->max_ns)
+            c->max_ns = ns;
+        ++c->histogram[histogram_bucket(ns)];
+    }
+    lock_release(&device->lock);
+}
+
+uint32_t
+dcam_stats_copy(HDCAM h, struct Dcam4CallStats* out, uint32_t capacity)
+{
+    uint32_t count = 0;
+    struct device_calls* device = find_device(h);
+    if (device) {
+        lock_acquire(&device->lock);
+        count = device->count;
+        memcpy(out,
+               device->calls,
+               sizeof(*out) * (count < capacity ? count : capacity));
+        lock_release(&device->lock);
+    }
+    return count;
+}
+
+void
+dcam_stats_reset(HDCAM h)
+{
+    struct device_calls* device = find_device(h);
+    if (device) {
+        lock_acquire(&device->lock);
+        device->count = 0;
+        lock_release(&device->lock);
+    }
+}
+
+/// Claims a free record for device `h`, or adds one.
+/// Must be called with `stats.lock` held.
+static void
+add_device__locked(HDCAM h)
+{
+    struct device_calls* d =
+      (struct device_calls*)load_acquire_ptr(&stats.head);
+    while (d && d->hdcam)
+        d = (struct device_calls*)d->next;
+    if (!d) {
+        if (!(d = (struct device_calls*)calloc(1, sizeof(*d)))) {
+            LOG("Warning: Out of memory for DCAM call statistics. Calls for "
+                "this device won't be recorded.");
+            return;
+        }
+        lock_init(&d->lock);
+        d->next = stats.head;
+        store_release_ptr(&stats.head, (void*)d);
+    }
+    lock_acquire(&d->lock);
+    d->count = 0;
+    d->is_drop_reported = 0;
+    lock_release(&d->lock);
+    store_release_ptr(&d->hwait, (void*)0);
+    store_release_ptr(&d->hdcam, (void*)h);
+}
+
+// Times `call` and records it against device handle `h`, under the name of
+// the calling stand-in without its "timed_" prefix.
+#define TIMED(h, prop_id, call)                                                \
+    do {                                                                       \
+        struct clock started;                                                  \
+        clock_init(&started);                                                  \
+        const DCAMERR ecode = (call);                                          \
+        record(find_device(h), __func__ + 6, (prop_id), &started);             \
+        return ecode;                                                          \
+    } while (0)
+
+// Like TIMED(), for calls on a wait handle.
+#define TIMED_WAIT(w, call)                                                    \
+    do {                                                                       \
+        struct clock started;                                                  \
+        clock_init(&started);                                                  \
+        const DCAMERR ecode = (call);                                          \
+        record(find_device_by_wait(w), __func__ + 6, 0, &started);             \
+        return ecode;                                                          \
+    } while (0)
+
+DCAMERR
+timed_dcamdev_open(DCAMDEV_OPEN* param)
+{
+    struct clock started;
+    clock_init(&started);
+    const DCAMERR ecode = dcamdev_open(param);
+    if ((int)ecode >= 0) {
+        lock_acquire(&stats.lock);
+        add_device__locked(param->hdcam);
+        lock_release(&stats.lock);
+    }
+    record(find_device(param->hdcam), __func__ + 6, 0, &started);
+    return ecode;
+}
+
+DCAMERR
+timed_dcamdev_close(HDCAM h)
+{
+    const DCAMERR ecode = dcamdev_close(h);
+    // The handle may be reused by the next device opened.
+    lock_acquire(&stats.lock);
+    struct device_calls* device = find_device(h);
+    if (device) {
+        store_release_ptr(&device->hdcam, (void*)0);
+        store_release_ptr(&device->hwait, (void*)0);
+    }
+    lock_release(&stats.lock);
+    return ecode;
+}
+
+DCAMERR
+timed_dcamdev_getstring(HDCAM h, DCAMDEV_STRING* param)
+{
+    TIMED(h, 0, dcamdev_getstring(h, param));
+}
+
+DCAMERR
+timed_dcamprop_getattr(HDCAM h, DCAMPROP_ATTR* param)
+{
+    TIMED(h, param->iProp, dcamprop_getattr(h, param));
+}
+
+DCAMERR
+timed_dcamprop_getvalue(HDCAM h, int32 iProp, double* pValue)
+{
+    TIMED(h, iProp, dcamprop_getvalue(h, iProp, pValue));
+}
+
+DCAMERR
+timed_dcamprop_setvalue(HDCAM h, int32 iProp, double fValue)
+{
+    TIMED(h, iProp, dcamprop_setvalue(h, iProp, fValue));
+}
+
+DCAMERR
+timed_dcamprop_setgetvalue(HDCAM h, int32 iProp, double* pValue, int32 option)
+{
+    TIMED(h, iProp, dcamprop_setgetvalue(h, iProp, pValue, option));
+}
+
+DCAMERR
+timed_dcambuf_alloc(HDCAM h, int32 framecount)
+{
+    TIMED(h, 0, dcambuf_alloc(h, framecount));
+}
+
+DCAMERR
+timed_dcambuf_attach(HDCAM h, const DCAMBUF_ATTACH* param)
+{
+    TIMED(h, 0, dcambuf_attach(h, param));
+}
+
+DCAMERR
+timed_dcambuf_release(HDCAM h, int32 iKind)
+{
+    TIMED(h, 0, dcambuf_release(h, iKind));
+}
+
+DCAMERR
+timed_dcambuf_lockframe(HDCAM h, DCAMBUF_FRAME* pFrame)
+{
+    TIMED(h, 0, dcambuf_lockframe(h, pFrame));
+}
+
+DCAMERR
+timed_dcamcap_start(HDCAM h, int32 mode)
+{
+    TIMED(h, 0, dcamcap_start(h, mode));
+}
+
+DCAMERR
+timed_dcamcap_stop(HDCAM h)
+{
+    TIMED(h, 0, dcamcap_stop(h));
+}
+
+DCAMERR
+timed_dcamcap_transferinfo(HDCAM h, DCAMCAP_TRANSFERINFO* param)
+{
+    TIMED(h, 0, dcamcap_transferinfo(h, param));
+}
+
+DCAMERR
+timed_dcamcap_firetrigger(HDCAM h, int32 iKind)
+{
+    TIMED(h, 0, dcamcap_firetrigger(h, iKind));
+}
+
+DCAMERR
+timed_dcamwait_open(DCAMWAIT_OPEN* param)
+{
+    struct clock started;
+    clock_init(&started);
+    const DCAMERR ecode = dcamwait_open(param);
+    if ((int)ecode >= 0) {
+        lock_acquire(&stats.lock);
+        struct device_calls* device = find_device(param->hdcam);
+        if (device)
+            store_release_ptr(&device->hwait, (void*)param->hwait);
+        lock_release(&stats.lock);
+    }
+    record(find_device(param->hdcam), __func__ + 6, 0, &started);
+    return ecode;
+}
+
+DCAMERR
+timed_dcamwait_close(HDCAMWAIT hWait)
+{
+    TIMED_WAIT(hWait, dcamwait_close(hWait));
+}
+
+DCAMERR
+timed_dcamwait_start(HDCAMWAIT hWait, DCAMWAIT_START* param)
+{
+    TIMED_WAIT(hWait, dcamwait_start(hWait, param));
+}
+
+DCAMERR
+timed_dcamwait_abort(HDCAMWAIT hWait)
+{
+    TIMED_WAIT(hWait, dcamwait_abort(hWait));
+}
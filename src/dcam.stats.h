@@ -0,0 +1,80 @@
+#ifndef H_ACQUIRE_DCAM_STATS_V0
+#define H_ACQUIRE_DCAM_STATS_V0
+
+#include <stddef.h> // must come before dcamapi4.h
+#include <stdint.h>
+#include <dcamapi4.h>
+
+#define DCAM_STATS_BUCKETS 32
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /// Timing of one kind of DCAM call made for a camera.
+    /// See aq_dcam_get_call_stats().
+    struct Dcam4CallStats
+    {
+        const char* function; // e.g. "dcamprop_setvalue"
+        int32_t prop_id; // DCAM_IDPROP_* for property calls, otherwise 0
+        uint64_t count;
+        uint64_t total_ns;
+        uint64_t max_ns;
+        // histogram[i] counts calls that took from 2^i up to 2^(i+1) ns. The
+        // last bucket also counts anything slower.
+        uint64_t histogram[DCAM_STATS_BUCKETS];
+    };
+
+    /// @brief Prepares the call statistics tables. Call once before any DCAM
+    ///        calls are made.
+    void dcam_stats_init(void);
+
+    /// @brief Frees the call statistics of every device. Call once no more
+    ///        DCAM calls will be made.
+    void dcam_stats_shutdown(void);
+
+    /// @brief Copies up to `capacity` of the call statistics for device `h`
+    ///        into `out`.
+    /// @returns The number of kinds of call recorded, which may be more than
+    ///          `capacity`.
+    uint32_t dcam_stats_copy(HDCAM h,
+                             struct Dcam4CallStats* out,
+                             uint32_t capacity);
+
+    /// @brief Clears the call statistics for device `h`.
+    void dcam_stats_reset(HDCAM h);
+
+    // Timed stand-ins for the DCAM functions the driver uses. When the driver
+    // is built with AQ_DCAM_INSTRUMENT, dcam.prelude.h routes calls through
+    // these. Statistics are kept per device handle, from dcamdev_open() until
+    // dcamdev_close().
+
+    DCAMERR timed_dcamdev_open(DCAMDEV_OPEN* param);
+    DCAMERR timed_dcamdev_close(HDCAM h);
+    DCAMERR timed_dcamdev_getstring(HDCAM h, DCAMDEV_STRING* param);
+    DCAMERR timed_dcamprop_getattr(HDCAM h, DCAMPROP_ATTR* param);
+    DCAMERR timed_dcamprop_getvalue(HDCAM h, int32 iProp, double* pValue);
+    DCAMERR timed_dcamprop_setvalue(HDCAM h, int32 iProp, double fValue);
+    DCAMERR timed_dcamprop_setgetvalue(HDCAM h,
+                                       int32 iProp,
+                                       double* pValue,
+                                       int32 option);
+    DCAMERR timed_dcambuf_alloc(HDCAM h, int32 framecount);
+    DCAMERR timed_dcambuf_attach(HDCAM h, const DCAMBUF_ATTACH* param);
+    DCAMERR timed_dcambuf_release(HDCAM h, int32 iKind);
+    DCAMERR timed_dcambuf_lockframe(HDCAM h, DCAMBUF_FRAME* pFrame);
+    DCAMERR timed_dcamcap_start(HDCAM h, int32 mode);
+    DCAMERR timed_dcamcap_stop(HDCAM h);
+    DCAMERR timed_dcamcap_transferinfo(HDCAM h, DCAMCAP_TRANSFERINFO* param);
+    DCAMERR timed_dcamcap_firetrigger(HDCAM h, int32 iKind);
+    DCAMERR timed_dcamwait_open(DCAMWAIT_OPEN* param);
+    DCAMERR timed_dcamwait_close(HDCAMWAIT hWait);
+    DCAMERR timed_dcamwait_start(HDCAMWAIT hWait, DCAMWAIT_START* param);
+    DCAMERR timed_dcamwait_abort(HDCAMWAIT hWait);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // H_ACQUIRE_DCAM_STATS_V0
@@ -0,0 +1,143 @@
+/// The element layout of array properties should be fetched from DCAM once
+/// per open device, not on every access.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+extern "C"
+{
+#include "dcam.getset.h"
+}
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+
+#include <dcamprop.h>
+
+#include <cstdio>
+#include <stdexcept>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+static HDCAM
+hdcam_of(struct Device* device)
+{
+    // Camera is the first member of Dcam4Camera.
+    return ((struct Dcam4Camera*)device)->hdcam;
+}
+
+static void
+read_output_trigger_kinds(HDCAM h)
+{
+    for (uint32_t i = 0; i < 3; ++i) {
+        int32_t kind = 0;
+        CHECK(array_prop_read_i32(
+          h, DCAM_IDPROP_OUTPUTTRIGGER_KIND, i, &kind, "kind"));
+    }
+}
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        dcamstub_reset();
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        dcamstub_clear_calls();
+        DEVOK(driver->open(driver, 0, &device));
+        const uint64_t getattr_open = dcamstub_get_calls()->getattr;
+
+        // The layouts read while opening the camera are reused.
+        dcamstub_clear_calls();
+        read_output_trigger_kinds(hdcam_of(device));
+        read_output_trigger_kinds(hdcam_of(device));
+        CHECK(dcamstub_get_calls()->getattr == 0);
+
+        // Each property has its own layout. The polarity isn't read on open.
+        {
+            dcamstub_clear_calls();
+            double v = 0.0;
+            CHECK(array_prop_write_f64(hdcam_of(device),
+                                       DCAM_IDPROP_OUTPUTTRIGGER_POLARITY,
+                                       1,
+                                       0.0,
+                                       "polarity"));
+            CHECK(array_prop_read_f64(hdcam_of(device),
+                                      DCAM_IDPROP_OUTPUTTRIGGER_POLARITY,
+                                      1,
+                                      &v,
+                                      "polarity"));
+            CHECK(dcamstub_get_calls()->getattr == 1);
+        }
+
+        // Configuring output triggers takes no more attribute queries than
+        // any other configuration.
+        {
+            auto camera = (struct Camera*)device;
+            CameraProperties props = {};
+            DEVOK(camera->get(camera, &props));
+            DEVOK(camera->set(camera, &props)); // reads the capabilities
+            props.exposure_time_us *= 2.0f;
+            dcamstub_clear_calls();
+            DEVOK(camera->set(camera, &props));
+            const uint64_t getattr_other = dcamstub_get_calls()->getattr;
+
+            props.output_triggers.exposure.enable = 1;
+            props.output_triggers.exposure.line = 1;
+            props.output_triggers.exposure.kind = Signal_Output;
+            dcamstub_clear_calls();
+            DEVOK(camera->set(camera, &props));
+            EXPECT(dcamstub_get_calls()->getattr == getattr_other,
+                   "Expected %d attribute queries. Got %d.",
+                   (int)getattr_other,
+                   (int)dcamstub_get_calls()->getattr);
+        }
+
+        // Layouts are forgotten when the device is closed, since the handle
+        // may be reused.
+        DEVOK(driver->close(driver, device));
+        dcamstub_clear_calls();
+        DEVOK(driver->open(driver, 0, &device));
+        CHECK(dcamstub_get_calls()->getattr == getattr_open);
+
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
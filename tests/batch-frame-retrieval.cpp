@@ -0,0 +1,159 @@
+/// In sequential retrieval mode every frame in the DCAM ring is delivered in
+/// order, and the camera is only waited on once the backlog is drained.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        dcamstub_reset();
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+
+        CameraProperties props = {};
+        DEVOK(camera->get(camera, &props));
+        props.pixel_type = SampleType_u16;
+        props.shape = { .x = 64, .y = 48 };
+        DEVOK(camera->set(camera, &props));
+
+        Dcam4Options options = {};
+        DEVOK(aq_dcam_get_options(camera, &options));
+        CHECK(options.retrieval == Dcam4Retrieval_Newest);
+        options.retrieval = Dcam4Retrieval_Sequential;
+        DEVOK(aq_dcam_set_options(camera, &options));
+
+        const size_t bytes_of_frame = 64 * 48 * 2;
+        std::vector<uint8_t> im(32 * bytes_of_frame);
+        ImageInfo info[32] = {};
+        int32_t expected = 0;
+
+        DEVOK(camera->start(camera));
+
+        // A backlog is drained in order with a single wait.
+        {
+            dcamstub_set_frames_per_wait(5);
+            dcamstub_clear_calls();
+            size_t nframes = 0, nbytes = 0;
+            DEVOK(aq_dcam_get_frames(
+              camera, im.data(), im.size(), info, 0, 32, &nframes, &nbytes));
+            CHECK(nframes == 5);
+            CHECK(nbytes == 5 * bytes_of_frame);
+            CHECK(dcamstub_get_calls()->wait == 1);
+            for (size_t i = 0; i < nframes; ++i) {
+                EXPECT(info[i].hardware_frame_id == expected,
+                       "Expected frame %d. Got %d.",
+                       expected,
+                       (int)info[i].hardware_frame_id);
+                const auto px =
+                  (const uint16_t*)(im.data() + i * bytes_of_frame);
+                CHECK(px[64 * 2 + 1] == dcamstub_pixel(expected, 1, 2));
+                ++expected;
+            }
+        }
+
+        // get_frame() only waits once the backlog is empty.
+        {
+            dcamstub_clear_calls();
+            for (int i = 0; i < 5; ++i) {
+                size_t nbytes = 0;
+                DEVOK(camera->get_frame(camera, im.data(), &nbytes, info));
+                CHECK(nbytes == bytes_of_frame);
+                CHECK(info[0].hardware_frame_id == expected++);
+            }
+            CHECK(dcamstub_get_calls()->wait == 1);
+        }
+
+        // Frames overwritten in the ring are skipped, and delivery resumes
+        // in order with the oldest frame that's still intact. The gap is
+        // reported with the frame after it.
+        {
+            const int32_t ring_depth = 10;
+            dcamstub_set_frames_per_wait(3 * ring_depth);
+            size_t nframes = 0, nbytes = 0;
+            uint32_t gaps[32] = {};
+            DEVOK(aq_dcam_get_frames(camera,
+                                     im.data(),
+                                     im.size(),
+                                     info,
+                                     gaps,
+                                     32,
+                                     &nframes,
+                                     &nbytes));
+            CHECK(nframes == ring_depth - 1);
+            const uint32_t gap = 3 * ring_depth - (ring_depth - 1);
+            expected += gap;
+            for (size_t i = 0; i < nframes; ++i) {
+                CHECK(info[i].hardware_frame_id == expected++);
+                CHECK(gaps[i] == (i == 0 ? gap : 0));
+            }
+        }
+
+        // The batch is limited by the number of frames requested.
+        {
+            dcamstub_set_frames_per_wait(4);
+            size_t nframes = 0, nbytes = 0;
+            DEVOK(aq_dcam_get_frames(
+              camera, im.data(), im.size(), info, 0, 3, &nframes, &nbytes));
+            CHECK(nframes == 3);
+            DEVOK(aq_dcam_get_frames(
+              camera, im.data(), im.size(), info, 0, 3, &nframes, &nbytes));
+            CHECK(nframes == 1);
+            CHECK(info[0].hardware_frame_id == expected + 3);
+        }
+
+        DEVOK(camera->stop(camera));
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
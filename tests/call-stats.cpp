@@ -0,0 +1,175 @@
+/// With the driver built with AQ_DCAM_INSTRUMENT, every DCAM call should be
+/// counted and timed against its camera, by function and property id.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <cstring>
+#include <vector>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+static const Dcam4CallStats*
+find(const std::vector<Dcam4CallStats>& stats,
+     const char* function,
+     int32_t prop_id)
+{
+    for (const auto& s : stats)
+        if (strcmp(s.function, function) == 0 && s.prop_id == prop_id)
+            return &s;
+    return 0;
+}
+
+static std::vector<Dcam4CallStats>
+get_call_stats(const struct Camera* camera)
+{
+    uint32_t count = 0;
+    DEVOK(aq_dcam_get_call_stats(camera, 0, 0, &count));
+    std::vector<Dcam4CallStats> stats(count);
+    DEVOK(aq_dcam_get_call_stats(camera, stats.data(), count, &count));
+    CHECK(count == stats.size());
+    return stats;
+}
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        dcamstub_reset();
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        dcamstub_clear_calls();
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+
+        CameraProperties props = {};
+        DEVOK(camera->get(camera, &props));
+        props.pixel_type = SampleType_u16;
+        props.shape = { .x = 64, .y = 48 };
+        props.exposure_time_us = 2000.0f;
+        DEVOK(camera->set(camera, &props));
+
+        std::vector<uint8_t> im(64 * 48 * 2);
+        ImageInfo info = {};
+        DEVOK(camera->start(camera));
+        for (int i = 0; i < 5; ++i) {
+            size_t nbytes = 0;
+            DEVOK(camera->get_frame(camera, im.data(), &nbytes, &info));
+            CHECK(nbytes == im.size());
+        }
+        DEVOK(camera->stop(camera));
+
+        {
+            const auto stats = get_call_stats(camera);
+
+            // Every attribute query is accounted for.
+            uint64_t getattr = 0;
+            for (const auto& s : stats)
+                if (strcmp(s.function, "dcamprop_getattr") == 0)
+                    getattr += s.count;
+            CHECK(getattr == dcamstub_get_calls()->getattr);
+
+            // Property calls are told apart by property id.
+            const Dcam4CallStats* exposure = find(
+              stats, "dcamprop_setgetvalue", DCAM_IDPROP_EXPOSURETIME);
+            CHECK(exposure);
+            CHECK(exposure->count == 1);
+
+            const Dcam4CallStats* wait = find(stats, "dcamwait_start", 0);
+            CHECK(wait);
+            CHECK(wait->count >= 5);
+
+            for (const auto& s : stats) {
+                uint64_t n = 0;
+                for (auto h : s.histogram)
+                    n += h;
+                CHECK(n == s.count);
+                CHECK(s.max_ns <= s.total_ns);
+            }
+
+            // A short buffer gets what fits, and the number available.
+            Dcam4CallStats first = {};
+            uint32_t count = 0;
+            DEVOK(aq_dcam_get_call_stats(camera, &first, 1, &count));
+            CHECK(count == stats.size());
+            CHECK(strcmp(first.function, stats[0].function) == 0);
+        }
+        DEVOK(aq_dcam_log_call_stats(camera));
+
+        DEVOK(aq_dcam_reset_call_stats(camera));
+        CHECK(get_call_stats(camera).empty());
+        props.exposure_time_us = 3000.0f;
+        DEVOK(camera->set(camera, &props));
+        {
+            const auto stats = get_call_stats(camera);
+            CHECK(stats.size() == 1);
+            CHECK(
+              find(stats, "dcamprop_setgetvalue", DCAM_IDPROP_EXPOSURETIME));
+        }
+
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+
+        // Each camera has its own statistics, however many are open.
+        dcamstub_reset();
+        dcamstub_set_device_count(12);
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        std::vector<struct Camera*> cameras;
+        for (uint64_t i = 0; i < 12; ++i) {
+            DEVOK(driver->open(driver, i, &device));
+            cameras.push_back((struct Camera*)device);
+        }
+        for (auto c : cameras) {
+            const auto stats = get_call_stats(c);
+            const Dcam4CallStats* open = find(stats, "dcamdev_open", 0);
+            CHECK(open);
+            CHECK(open->count == 1);
+        }
+        for (auto c : cameras)
+            DEVOK(driver->close(driver, &c->device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
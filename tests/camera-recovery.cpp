@@ -0,0 +1,127 @@
+/// When a camera fails to start, the driver reopens just that camera and
+/// restores its properties, leaving other cameras running.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+/// Checks that `camera` delivers a frame `width` pixels wide.
+static void
+expect_frame(struct Camera* camera, uint32_t width)
+{
+    Dcam4Frame frame = {};
+    DEVOK(aq_dcam_lock_frame(camera, &frame));
+    CHECK(frame.info.shape.dims.width == width);
+    DEVOK(aq_dcam_unlock_frame(camera, &frame));
+}
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        dcamstub_reset();
+        dcamstub_set_device_count(2);
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Camera* cameras[2] = {};
+        for (uint64_t i = 0; i < 2; ++i) {
+            struct Device* device = 0;
+            DEVOK(driver->open(driver, i, &device));
+            // The runtime records the identifier of each device it opens.
+            DEVOK(driver->describe(driver, &device->identifier, i));
+            cameras[i] = (struct Camera*)device;
+
+            CameraProperties props = {};
+            DEVOK(cameras[i]->get(cameras[i], &props));
+            props.pixel_type = SampleType_u16;
+            props.shape = { .x = 48, .y = 32 };
+            DEVOK(cameras[i]->set(cameras[i], &props));
+        }
+
+        DEVOK(cameras[1]->start(cameras[1]));
+        expect_frame(cameras[1], 48);
+
+        // The first start fails. Only that camera is reopened.
+        dcamstub_clear_calls();
+        dcamstub_fault_device(0);
+        DEVOK(cameras[0]->start(cameras[0]));
+        CHECK(dcamstub_get_calls()->open == 1);
+        CHECK(dcamstub_get_calls()->init == 0);
+        CHECK(cameras[0]->state == DeviceState_Armed);
+
+        // Its properties were restored, and the other camera never stopped.
+        expect_frame(cameras[0], 48);
+        expect_frame(cameras[1], 48);
+        DEVOK(cameras[0]->stop(cameras[0]));
+
+        // Failures that aren't DCAM's to start don't recover the camera.
+        {
+            Dcam4Options options = {};
+            DEVOK(aq_dcam_get_options(cameras[0], &options));
+            options.ring_depth = 0;
+            DEVOK(aq_dcam_set_options(cameras[0], &options));
+            dcamstub_clear_calls();
+            dcamstub_fail_getvalue(DCAM_IDPROP_INTERNALFRAMEINTERVAL);
+            CHECK(Device_Err == cameras[0]->start(cameras[0]));
+            dcamstub_fail_getvalue(0);
+            CHECK(dcamstub_get_calls()->open == 0);
+            CHECK(dcamstub_get_calls()->init == 0);
+
+            Dcam4Status status = {};
+            DEVOK(aq_dcam_get_status(cameras[0], &status));
+            CHECK(status.recovery.count == 1);
+            DEVOK(cameras[0]->start(cameras[0]));
+            expect_frame(cameras[0], 48);
+        }
+
+        for (auto camera : cameras) {
+            DEVOK(camera->stop(camera));
+            DEVOK(driver->close(driver, &camera->device));
+        }
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
@@ -0,0 +1,110 @@
+/// The driver opens as many cameras as DCAM reports, each independently.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+#include <cstring>
+#include <string>
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        dcamstub_reset();
+        dcamstub_set_device_count(6);
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        const uint32_t n = driver->device_count(driver);
+        CHECK(n == 6);
+
+        struct Device* devices[6] = {};
+        for (uint32_t i = 0; i < n; ++i) {
+            DeviceIdentifier id = {};
+            DEVOK(driver->describe(driver, &id, i));
+            CHECK(id.device_id == i);
+            const std::string serial = "S/N: 00000" + std::to_string(i + 1);
+            EXPECT(std::strstr(id.name, serial.c_str()),
+                   "Expected %s in \"%s\"",
+                   serial.c_str(),
+                   id.name);
+            DEVOK(driver->open(driver, i, &devices[i]));
+        }
+        {
+            struct Device* device = 0;
+            CHECK(Device_Err == driver->open(driver, n, &device));
+            CHECK(!device);
+        }
+
+        // Each camera captures on its own.
+        for (uint32_t i = 0; i < n; ++i) {
+            auto camera = (struct Camera*)devices[i];
+            CameraProperties props = {};
+            DEVOK(camera->get(camera, &props));
+            props.pixel_type = SampleType_u16;
+            props.shape = { .x = 32 + 8 * i, .y = 16 };
+            DEVOK(camera->set(camera, &props));
+            DEVOK(camera->start(camera));
+        }
+        for (uint32_t i = 0; i < n; ++i) {
+            auto camera = (struct Camera*)devices[i];
+            Dcam4Frame frame = {};
+            DEVOK(aq_dcam_lock_frame(camera, &frame));
+            CHECK(frame.info.shape.dims.width == 32 + 8 * i);
+            DEVOK(aq_dcam_unlock_frame(camera, &frame));
+            DEVOK(camera->stop(camera));
+        }
+
+        // A slot is free again once its camera is closed.
+        DEVOK(driver->close(driver, devices[4]));
+        DEVOK(driver->open(driver, 4, &devices[4]));
+
+        for (uint32_t i = 0; i < n; ++i)
+            DEVOK(driver->close(driver, devices[i]));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
@@ -0,0 +1,216 @@
+/// With the capture thread on, frames are copied out of the DCAM ring by the
+/// driver as they arrive and get_frame() takes them from the driver's queue,
+/// in order, without waiting on the camera itself.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+#include "platform.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        dcamstub_reset();
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+
+        CameraProperties props = {};
+        DEVOK(camera->get(camera, &props));
+        props.pixel_type = SampleType_u16;
+        props.shape = { .x = 64, .y = 48 };
+        DEVOK(camera->set(camera, &props));
+
+        Dcam4Options options = {};
+        DEVOK(aq_dcam_get_options(camera, &options));
+        CHECK(!options.use_capture_thread);
+        options.retrieval = Dcam4Retrieval_Sequential;
+        options.use_capture_thread = 1;
+        options.queue_depth = 0;
+        CHECK(Device_Err == aq_dcam_set_options(camera, &options));
+        options.queue_depth = 4;
+        DEVOK(aq_dcam_set_options(camera, &options));
+
+        const size_t bytes_of_frame = 64 * 48 * 2;
+        std::vector<uint8_t> im(8 * bytes_of_frame);
+        ImageInfo info[8] = {};
+        uint64_t last_id = 0;
+
+        DEVOK(camera->start(camera));
+
+        // Frames arrive in order, without gaps.
+        for (int i = 0; i < 20; ++i) {
+            size_t nbytes = 0;
+            DEVOK(camera->get_frame(camera, im.data(), &nbytes, info));
+            CHECK(nbytes == bytes_of_frame);
+            CHECK(info->shape.dims.width == 64);
+            CHECK(info->shape.dims.height == 48);
+            if (i > 0) {
+                EXPECT(info->hardware_frame_id == last_id + 1,
+                       "Expected frame %d. Got %d.",
+                       (int)last_id + 1,
+                       (int)info->hardware_frame_id);
+            }
+            last_id = info->hardware_frame_id;
+
+            const auto stamp = (int32_t)info->hardware_frame_id;
+            const auto pixels = (const uint16_t*)im.data();
+            for (int32_t y = 0; y < 48; ++y)
+                for (int32_t x = 0; x < 64; ++x)
+                    CHECK(pixels[y * 64 + x] == dcamstub_pixel(stamp, x, y));
+        }
+
+        // The thread fills the queue while the consumer is away, then leaves
+        // frames in the DCAM ring.
+        clock_sleep_ms(0, 50);
+        {
+            Dcam4Status status = {};
+            DEVOK(aq_dcam_get_status(camera, &status));
+            CHECK(status.queue.depth == 4);
+            EXPECT(status.queue.high_water == 4,
+                   "Expected a high-water mark of 4. Got %d.",
+                   status.queue.high_water);
+            CHECK(status.queue.stalls >= 1);
+        }
+
+        // A full queue is drained with one call.
+        {
+            size_t nframes = 0, nbytes = 0;
+            DEVOK(aq_dcam_get_frames(
+              camera, im.data(), im.size(), info, 0, 8, &nframes, &nbytes));
+            EXPECT(nframes == 4, "Expected 4 frames. Got %d.", (int)nframes);
+            CHECK(nbytes == nframes * bytes_of_frame);
+            for (size_t i = 0; i < nframes; ++i) {
+                CHECK(info[i].hardware_frame_id == last_id + 1);
+                last_id = info[i].hardware_frame_id;
+            }
+        }
+
+        // Frames from the ring are all accounted for.
+        {
+            size_t nbytes = 0;
+            DEVOK(camera->get_frame(camera, im.data(), &nbytes, info));
+            CHECK(info->hardware_frame_id == last_id + 1);
+            Dcam4Status status = {};
+            DEVOK(aq_dcam_get_status(camera, &status));
+            CHECK(status.frames.dropped == 0);
+            last_id = info->hardware_frame_id;
+        }
+
+        // Each frame in a batch carries the gap before it. Frames are lost
+        // while the thread waits for room in the queue again. The thread
+        // calls the stub with the camera lock held, and taking the lock
+        // around the change orders it with those calls.
+        clock_sleep_ms(0, 50);
+        {
+            Dcam4Status status = {};
+            DEVOK(aq_dcam_get_status(camera, &status));
+            dcamstub_lose_frames(2);
+            DEVOK(aq_dcam_get_status(camera, &status));
+        }
+        {
+            size_t nframes = 0, nbytes = 0;
+            uint32_t gaps[8] = {};
+            DEVOK(aq_dcam_get_frames(camera,
+                                     im.data(),
+                                     im.size(),
+                                     info,
+                                     gaps,
+                                     8,
+                                     &nframes,
+                                     &nbytes));
+            CHECK(nframes == 4);
+            for (size_t i = 0; i < nframes; ++i)
+                CHECK(gaps[i] == 0);
+            last_id = info[nframes - 1].hardware_frame_id;
+
+            DEVOK(aq_dcam_get_frames(camera,
+                                     im.data(),
+                                     im.size(),
+                                     info,
+                                     gaps,
+                                     1,
+                                     &nframes,
+                                     &nbytes));
+            CHECK(nframes == 1);
+            CHECK(info[0].hardware_frame_id == last_id + 3);
+            CHECK(gaps[0] == 2);
+        }
+
+        // Frames can't be held in the DCAM ring.
+        {
+            Dcam4Frame frame = {};
+            CHECK(Device_Err == aq_dcam_lock_frame(camera, &frame));
+        }
+
+        DEVOK(camera->stop(camera));
+
+        // Without the thread, frames come straight from the DCAM ring again.
+        options.use_capture_thread = 0;
+        DEVOK(aq_dcam_set_options(camera, &options));
+        DEVOK(camera->start(camera));
+        {
+            size_t nbytes = 0;
+            DEVOK(camera->get_frame(camera, im.data(), &nbytes, info));
+            CHECK(nbytes == bytes_of_frame);
+            Dcam4Status status = {};
+            DEVOK(aq_dcam_get_status(camera, &status));
+            CHECK(status.queue.depth == 0);
+            Dcam4Frame frame = {};
+            DEVOK(aq_dcam_lock_frame(camera, &frame));
+            DEVOK(aq_dcam_unlock_frame(camera, &frame));
+        }
+        DEVOK(camera->stop(camera));
+
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
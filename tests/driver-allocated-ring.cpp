@@ -0,0 +1,117 @@
+/// The driver can allocate the capture ring itself and hand it to DCAM with
+/// dcambuf_attach.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        dcamstub_reset();
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+
+        CameraProperties props = {};
+        DEVOK(camera->get(camera, &props));
+        props.pixel_type = SampleType_u16;
+        props.shape = { .x = 64, .y = 48 };
+        DEVOK(camera->set(camera, &props));
+        const uint64_t bytes_of_frame = 64 * 48 * 2;
+
+        Dcam4Options options = {};
+        DEVOK(aq_dcam_get_options(camera, &options));
+        options.allocation = Dcam4Allocation_Driver;
+        options.ring_depth = 7;
+        options.numa_node = 0;
+        DEVOK(aq_dcam_set_options(camera, &options));
+
+        for (int run = 0; run < 2; ++run) {
+            dcamstub_clear_calls();
+            DEVOK(camera->start(camera));
+            // The second start reuses the ring from the first.
+            CHECK(dcamstub_get_calls()->attach == (run == 0 ? 1 : 0));
+            CHECK(dcamstub_get_calls()->alloc == 0);
+
+            Dcam4Status status = {};
+            DEVOK(aq_dcam_get_status(camera, &status));
+            CHECK(status.ring.depth == 7);
+            CHECK(status.ring.is_driver_allocated);
+            CHECK(status.ring.bytes >= 7 * bytes_of_frame);
+            LOG("Ring of %d frames: %llu bytes%s",
+                status.ring.depth,
+                (unsigned long long)status.ring.bytes,
+                status.ring.is_huge ? " on huge pages" : "");
+
+            for (int i = 0; i < 9; ++i) {
+                Dcam4Frame frame = {};
+                DEVOK(aq_dcam_lock_frame(camera, &frame));
+                EXPECT(((uintptr_t)frame.data & 4095) == 0,
+                       "Frame %d is not page aligned: %p",
+                       frame.index,
+                       frame.data);
+                const auto stamp = (int32_t)frame.info.hardware_frame_id;
+                const auto row = (const uint16_t*)((const uint8_t*)frame.data +
+                                                   5 * frame.pitch);
+                CHECK(row[3] == dcamstub_pixel(stamp, 3, 5));
+                DEVOK(aq_dcam_unlock_frame(camera, &frame));
+            }
+
+            DEVOK(camera->stop(camera));
+            DEVOK(aq_dcam_get_status(camera, &status));
+            CHECK(status.ring.is_driver_allocated);
+            CHECK(dcamstub_get_calls()->release == 0);
+        }
+
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
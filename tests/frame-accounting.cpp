@@ -0,0 +1,157 @@
+/// Frames missing from the stream should be counted, attributed to the ring
+/// or the transfer, and flagged on the frame that follows them.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+static Dcam4Frame
+next_frame(struct Camera* camera)
+{
+    Dcam4Frame frame = {};
+    DEVOK(aq_dcam_lock_frame(camera, &frame));
+    DEVOK(aq_dcam_unlock_frame(camera, &frame));
+    return frame;
+}
+
+static void
+expect_counts(struct Camera* camera,
+              uint64_t delivered,
+              uint64_t dropped,
+              uint64_t overwritten,
+              uint64_t lost_in_transfer)
+{
+    Dcam4Status status = {};
+    DEVOK(aq_dcam_get_status(camera, &status));
+    EXPECT(status.frames.delivered == delivered &&
+             status.frames.dropped == dropped &&
+             status.frames.overwritten == overwritten &&
+             status.frames.lost_in_transfer == lost_in_transfer,
+           "Expected delivered=%d dropped=%d overwritten=%d lost=%d. "
+           "Got %d %d %d %d.",
+           (int)delivered,
+           (int)dropped,
+           (int)overwritten,
+           (int)lost_in_transfer,
+           (int)status.frames.delivered,
+           (int)status.frames.dropped,
+           (int)status.frames.overwritten,
+           (int)status.frames.lost_in_transfer);
+}
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        dcamstub_reset();
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+
+        CameraProperties props = {};
+        DEVOK(camera->get(camera, &props));
+        props.pixel_type = SampleType_u16;
+        props.shape = { .x = 64, .y = 48 };
+        DEVOK(camera->set(camera, &props));
+
+        Dcam4Options options = {};
+        DEVOK(aq_dcam_get_options(camera, &options));
+        options.retrieval = Dcam4Retrieval_Sequential;
+        options.ring_depth = 10;
+        DEVOK(aq_dcam_set_options(camera, &options));
+
+        DEVOK(camera->start(camera));
+        for (int i = 0; i < 3; ++i)
+            CHECK(next_frame(camera).gap == 0);
+        expect_counts(camera, 3, 0, 0, 0);
+
+        // Frames that never reach the ring show up as a framestamp gap.
+        dcamstub_lose_frames(2);
+        {
+            const Dcam4Frame frame = next_frame(camera);
+            CHECK(frame.info.hardware_frame_id == 5);
+            CHECK(frame.gap == 2);
+        }
+        expect_counts(camera, 4, 2, 0, 2);
+
+        // The ring wraps around before the frames are read: 25 frames
+        // arrive while 9 slots can be held behind the writer.
+        dcamstub_set_frames_per_wait(25);
+        {
+            const Dcam4Frame frame = next_frame(camera);
+            CHECK(frame.info.hardware_frame_id == 22);
+            CHECK(frame.gap == 16);
+        }
+        expect_counts(camera, 5, 18, 16, 2);
+        {
+            Dcam4Status status = {};
+            DEVOK(aq_dcam_get_status(camera, &status));
+            CHECK(status.frames.last_gap_frame_id == 22);
+        }
+        dcamstub_set_frames_per_wait(1);
+        for (int i = 0; i < 8; ++i)
+            CHECK(next_frame(camera).gap == 0);
+        expect_counts(camera, 13, 18, 16, 2);
+        DEVOK(camera->stop(camera));
+
+        // Frames passed over for a newer one are dropped, but weren't lost.
+        // The counters carry over from the previous acquisition.
+        options.retrieval = Dcam4Retrieval_Newest;
+        DEVOK(aq_dcam_set_options(camera, &options));
+        dcamstub_set_frames_per_wait(3);
+        DEVOK(camera->start(camera));
+        CHECK(next_frame(camera).gap == 0);
+        CHECK(next_frame(camera).gap == 2);
+        expect_counts(camera, 15, 20, 16, 2);
+        DEVOK(camera->stop(camera));
+
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
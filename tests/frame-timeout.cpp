@@ -0,0 +1,144 @@
+/// With a frame timeout, get_frame() and friends come back empty-handed
+/// instead of blocking when no frame arrives in time, with or without the
+/// capture thread.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        dcamstub_reset();
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+
+        CameraProperties props = {};
+        DEVOK(camera->get(camera, &props));
+        props.pixel_type = SampleType_u16;
+        props.shape = { .x = 64, .y = 48 };
+        DEVOK(camera->set(camera, &props));
+
+        Dcam4Options options = {};
+        DEVOK(aq_dcam_get_options(camera, &options));
+        CHECK(options.frame_timeout_ms == -1);
+        options.frame_timeout_ms = -2;
+        CHECK(Device_Err == aq_dcam_set_options(camera, &options));
+        options.frame_timeout_ms = 0;
+        options.retrieval = Dcam4Retrieval_Sequential;
+        DEVOK(aq_dcam_set_options(camera, &options));
+
+        const size_t bytes_of_frame = 64 * 48 * 2;
+        std::vector<uint8_t> im(4 * bytes_of_frame);
+        ImageInfo info[4] = {};
+
+        DEVOK(camera->start(camera));
+
+        // Polling with nothing in the ring delivers nothing.
+        dcamstub_set_frames_per_wait(0);
+        {
+            size_t nbytes = 1;
+            DEVOK(camera->get_frame(camera, im.data(), &nbytes, info));
+            CHECK(nbytes == 0);
+
+            size_t nframes = 1;
+            DEVOK(aq_dcam_get_frames(
+              camera, im.data(), im.size(), info, 0, 4, &nframes, &nbytes));
+            CHECK(nframes == 0);
+            CHECK(nbytes == 0);
+
+            Dcam4Frame frame = {};
+            DEVOK(aq_dcam_lock_frame(camera, &frame));
+            CHECK(frame.data == 0);
+        }
+
+        // A bounded wait that times out delivers nothing either.
+        options.frame_timeout_ms = 20;
+        DEVOK(aq_dcam_set_options(camera, &options));
+        {
+            size_t nbytes = 1;
+            DEVOK(camera->get_frame(camera, im.data(), &nbytes, info));
+            CHECK(nbytes == 0);
+        }
+
+        // Frames are still delivered as soon as they arrive.
+        dcamstub_set_frames_per_wait(1);
+        options.frame_timeout_ms = 0;
+        DEVOK(aq_dcam_set_options(camera, &options));
+        {
+            size_t nbytes = 0;
+            DEVOK(camera->get_frame(camera, im.data(), &nbytes, info));
+            CHECK(nbytes == bytes_of_frame);
+
+            Dcam4Frame frame = {};
+            DEVOK(aq_dcam_lock_frame(camera, &frame));
+            CHECK(frame.data);
+            DEVOK(aq_dcam_unlock_frame(camera, &frame));
+        }
+        DEVOK(camera->stop(camera));
+
+        // The capture thread's queue can be polled too.
+        dcamstub_set_frames_per_wait(0);
+        options.use_capture_thread = 1;
+        DEVOK(aq_dcam_set_options(camera, &options));
+        DEVOK(camera->start(camera));
+        {
+            size_t nbytes = 1;
+            DEVOK(camera->get_frame(camera, im.data(), &nbytes, info));
+            CHECK(nbytes == 0);
+        }
+        DEVOK(camera->stop(camera));
+
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
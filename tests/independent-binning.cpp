@@ -0,0 +1,143 @@
+/// Horizontal and vertical binning by the camera can be set independently,
+/// and get_shape should report the binned frame.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+static void
+expect_binning(struct Camera* camera,
+               uint8_t horizontal,
+               uint8_t vertical,
+               uint32_t width,
+               uint32_t height)
+{
+    Dcam4Status status = {};
+    DEVOK(aq_dcam_get_status(camera, &status));
+    EXPECT(status.binning.horizontal == horizontal &&
+             status.binning.vertical == vertical,
+           "Expected %dx%d binning. Got %dx%d.",
+           horizontal,
+           vertical,
+           status.binning.horizontal,
+           status.binning.vertical);
+
+    ImageShape shape = {};
+    DEVOK(camera->get_shape(camera, &shape));
+    EXPECT(shape.dims.width == width && shape.dims.height == height,
+           "Expected a %dx%d frame. Got %dx%d.",
+           width,
+           height,
+           shape.dims.width,
+           shape.dims.height);
+    CHECK(shape.strides.height == width);
+}
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        dcamstub_reset();
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+
+        {
+            Dcam4BinningMetadata meta = {};
+            DEVOK(aq_dcam_get_binning_metadata(camera, &meta));
+            CHECK(meta.is_independent_supported);
+            CHECK(meta.horizontal.writable && meta.vertical.writable);
+            CHECK(meta.horizontal.low == 1 && meta.horizontal.high == 4);
+            CHECK(meta.vertical.low == 1 && meta.vertical.high == 8);
+        }
+
+        CameraProperties props = {};
+        DEVOK(camera->get(camera, &props));
+        props.pixel_type = SampleType_u16;
+        props.shape = { .x = 128, .y = 64 };
+        props.binning = 1;
+        DEVOK(camera->set(camera, &props));
+
+        // Oversampled along one axis only.
+        Dcam4Options options = {};
+        DEVOK(aq_dcam_get_options(camera, &options));
+        options.binning_horz = 1;
+        options.binning_vert = 4;
+        DEVOK(aq_dcam_set_options(camera, &options));
+        DEVOK(camera->set(camera, &props));
+        expect_binning(camera, 1, 4, 128, 16);
+
+        // 0 means no binning along that axis.
+        options.binning_horz = 2;
+        options.binning_vert = 0;
+        DEVOK(aq_dcam_set_options(camera, &options));
+        DEVOK(camera->set(camera, &props));
+        expect_binning(camera, 2, 1, 64, 64);
+
+        // Frames come out binned.
+        {
+            DEVOK(camera->start(camera));
+            uint16_t im[64 * 64] = {};
+            size_t nbytes = 0;
+            ImageInfo info = {};
+            DEVOK(camera->get_frame(camera, im, &nbytes, &info));
+            CHECK(nbytes == sizeof(im));
+            DEVOK(camera->stop(camera));
+        }
+
+        // Back to the same binning on both axes.
+        options.binning_horz = 0;
+        DEVOK(aq_dcam_set_options(camera, &options));
+        props.binning = 2;
+        DEVOK(camera->set(camera, &props));
+        expect_binning(camera, 2, 2, 64, 32);
+
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
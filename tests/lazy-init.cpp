@@ -0,0 +1,122 @@
+/// DCAM is initialized when the driver is first used rather than when it's
+/// loaded, and each device is only asked for its identifier once.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+#include <cstring>
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        // Loading the driver doesn't touch DCAM.
+        dcamstub_reset();
+        dcamstub_set_device_count(3);
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        CHECK(dcamstub_get_calls()->init == 0);
+
+        CHECK(driver->device_count(driver) == 3);
+        CHECK(dcamstub_get_calls()->init == 1);
+
+        DeviceIdentifier first[3] = {};
+        for (uint64_t i = 0; i < 3; ++i)
+            DEVOK(driver->describe(driver, first + i, i));
+        const uint64_t getstring = dcamstub_get_calls()->getstring;
+        CHECK(getstring > 0);
+
+        // Later listings come from the cache.
+        for (int pass = 0; pass < 3; ++pass) {
+            CHECK(driver->device_count(driver) == 3);
+            for (uint64_t i = 0; i < 3; ++i) {
+                DeviceIdentifier id = {};
+                DEVOK(driver->describe(driver, &id, i));
+                CHECK(id.device_id == first[i].device_id);
+                CHECK(id.kind == DeviceKind_Camera);
+                CHECK(0 == strcmp(id.name, first[i].name));
+            }
+        }
+        CHECK(dcamstub_get_calls()->getstring == getstring);
+        CHECK(dcamstub_get_calls()->init == 1);
+        {
+            DeviceIdentifier id = {};
+            CHECK(Device_Err == driver->describe(driver, &id, 3));
+        }
+        DEVOK(driver->shutdown(driver));
+
+        // Opening a camera initializes DCAM too.
+        dcamstub_reset();
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        CHECK(dcamstub_get_calls()->init == 1);
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+
+        // Without cameras, the driver still loads and reports none. DCAM
+        // isn't initialized again on every call.
+        dcamstub_reset();
+        dcamstub_set_device_count(0);
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        CHECK(driver->device_count(driver) == 0);
+        CHECK(driver->device_count(driver) == 0);
+        CHECK(Device_Err == driver->open(driver, 0, &device));
+        CHECK(dcamstub_get_calls()->init == 1);
+        DEVOK(driver->shutdown(driver));
+
+        // Neither is it after any other failure.
+        dcamstub_reset();
+        dcamstub_fail_init(1);
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        CHECK(driver->device_count(driver) == 0);
+        CHECK(driver->device_count(driver) == 0);
+        CHECK(dcamstub_get_calls()->init == 1);
+        DEVOK(driver->shutdown(driver));
+
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
@@ -0,0 +1,129 @@
+/// Capability ranges should be read from the camera once, and again only
+/// after something they depend on (binning, readout direction, pixel type or
+/// sensor mode) is changed.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <cstring>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+static uint64_t
+getattr_calls()
+{
+    return dcamstub_get_calls()->getattr;
+}
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        dcamstub_reset();
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+
+        CameraProperties props = {};
+        DEVOK(camera->get(camera, &props));
+        props.pixel_type = SampleType_u16;
+        props.binning = 1;
+        props.shape = { .x = 64, .y = 48 };
+        DEVOK(camera->set(camera, &props));
+
+        // Once read, capabilities are remembered.
+        CameraPropertyMetadata meta = {};
+        DEVOK(camera->get_meta(camera, &meta));
+        dcamstub_clear_calls();
+        {
+            CameraPropertyMetadata again = {};
+            DEVOK(camera->get_meta(camera, &again));
+            CHECK(getattr_calls() == 0);
+            CHECK(memcmp(&again, &meta, sizeof(meta)) == 0);
+        }
+
+        // Moving the ROI or changing the exposure doesn't change them.
+        for (uint32_t i = 0; i < 10; ++i) {
+            props.offset = { .x = 8 * i, .y = 4 * i };
+            props.exposure_time_us = 1000.0f + 100.0f * (float)i;
+            DEVOK(camera->set(camera, &props));
+        }
+        CHECK(getattr_calls() == 0);
+
+        // Each dependency read them again once.
+        props.binning = 2;
+        DEVOK(camera->set(camera, &props));
+        CHECK(getattr_calls() > 0);
+
+        dcamstub_clear_calls();
+        props.readout_direction = Direction_Backward;
+        DEVOK(camera->set(camera, &props));
+        CHECK(getattr_calls() > 0);
+
+        dcamstub_clear_calls();
+        props.pixel_type = SampleType_u8;
+        DEVOK(camera->set(camera, &props));
+        CHECK(getattr_calls() > 0);
+
+        dcamstub_clear_calls();
+        DEVOK(camera->get_meta(camera, &meta));
+        DEVOK(camera->set(camera, &props));
+        CHECK(getattr_calls() == 0);
+
+        // A refresh reads them again too.
+        DEVOK(aq_dcam_refresh(camera, &props));
+        dcamstub_clear_calls();
+        DEVOK(camera->get_meta(camera, &meta));
+        CHECK(getattr_calls() > 0);
+        CHECK(meta.binning.low == 1.0f);
+        CHECK(meta.binning.high == 4.0f);
+        CHECK(meta.shape.x.high == 2304.0f);
+
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
@@ -0,0 +1,149 @@
+/// aq_dcam_set() should write only what changed, in an order the camera
+/// accepts, and report how many DCAM calls it took.
+///
+/// Runs against the stub DCAM library, which, like the camera, refuses a
+/// subarray that runs off the sensor.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <cstring>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+static uint32_t
+configure_calls(const struct Camera* camera)
+{
+    Dcam4Status status = {};
+    DEVOK(aq_dcam_get_status(camera, &status));
+    return status.configure.last_calls;
+}
+
+static uint64_t
+setvalue_calls()
+{
+    return dcamstub_get_calls()->setvalue;
+}
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        dcamstub_reset();
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+
+        CameraProperties props = {};
+        DEVOK(camera->get(camera, &props));
+        props.pixel_type = SampleType_u16;
+        props.shape = { .x = 64, .y = 48 };
+        props.offset = { .x = 8, .y = 4 };
+        props.exposure_time_us = 2000.0f;
+        DEVOK(camera->set(camera, &props));
+        CHECK(configure_calls(camera) > 0);
+
+        // Nothing changed, so nothing is written.
+        dcamstub_clear_calls();
+        DEVOK(camera->set(camera, &props));
+        CHECK(configure_calls(camera) == 0);
+        CHECK(setvalue_calls() == 0);
+
+        // Moving to the next tile writes one offset.
+        props.offset.x = 72;
+        DEVOK(camera->set(camera, &props));
+        CHECK(configure_calls(camera) == 1);
+        CHECK(setvalue_calls() == 1);
+
+        // Changing the exposure writes just the exposure.
+        dcamstub_clear_calls();
+        props.exposure_time_us = 3000.0f;
+        DEVOK(camera->set(camera, &props));
+        CHECK(configure_calls(camera) == 1);
+        CHECK(setvalue_calls() == 1);
+
+        // Growing the subarray past the edge of the sensor from where it is
+        // means moving it first.
+        props.offset = { .x = 2200, .y = 2200 };
+        DEVOK(camera->set(camera, &props));
+        props.offset = { .x = 100, .y = 100 };
+        props.shape = { .x = 1024, .y = 1024 };
+        DEVOK(camera->set(camera, &props));
+        CHECK(configure_calls(camera) == 4);
+        {
+            CameraProperties actual = {};
+            DEVOK(aq_dcam_refresh(camera, &actual));
+            CHECK(actual.offset.x == 100 && actual.offset.y == 100);
+            CHECK(actual.shape.x == 1024 && actual.shape.y == 1024);
+        }
+
+        // Output triggers are written without the input triggers.
+        props.output_triggers.exposure.enable = 1;
+        props.output_triggers.exposure.line = 1;
+        props.output_triggers.exposure.kind = Signal_Output;
+        DEVOK(camera->set(camera, &props));
+        props.output_triggers.exposure.line = 2;
+        DEVOK(camera->set(camera, &props));
+        const uint32_t output_calls = configure_calls(camera);
+        props.input_triggers.frame_start.enable = 1;
+        props.input_triggers.frame_start.line = 0;
+        props.input_triggers.frame_start.kind = Signal_Input;
+        DEVOK(camera->set(camera, &props));
+        CHECK(configure_calls(camera) > 0);
+        props.output_triggers.exposure.line = 1;
+        DEVOK(camera->set(camera, &props));
+        CHECK(configure_calls(camera) == output_calls);
+
+        {
+            Dcam4Status status = {};
+            DEVOK(aq_dcam_get_status(camera, &status));
+            CHECK(status.configure.count == 10);
+            CHECK(status.configure.total_calls >= status.configure.count);
+        }
+
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
@@ -0,0 +1,215 @@
+/// SampleType_u12 should capture packed 12-bit frames and deliver them
+/// unpacked to 16 bits, or packed when asked to pass them through.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+#include "dcam.copy.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+static uint16_t
+unpack_one(const uint8_t* row, size_t x)
+{
+    const uint8_t* p = row + x / 2 * 3;
+    return (x & 1) ? (uint16_t)((p[1] >> 4) | (p[2] << 4))
+                   : (uint16_t)(p[0] | ((p[1] & 0x0f) << 8));
+}
+
+/// Compares unpack_mono12p_rows() with a pixel-at-a-time reference.
+static void
+check_kernel()
+{
+    const size_t height = 3;
+    for (size_t width = 1; width <= 100; ++width) {
+        for (size_t padding : { 0, 1, 24 }) {
+            const size_t pitch = (3 * width + 1) / 2 + padding;
+            std::vector<uint8_t> src(pitch * height);
+            for (size_t i = 0; i < src.size(); ++i)
+                src[i] = (uint8_t)(i * 29 + 3);
+            std::vector<uint16_t> dst(width * height + 1, 0xcdcd);
+            unpack_mono12p_rows(dst.data(), src.data(), width, pitch, height);
+            for (size_t y = 0; y < height; ++y) {
+                for (size_t x = 0; x < width; ++x) {
+                    EXPECT(dst[y * width + x] ==
+                             unpack_one(src.data() + y * pitch, x),
+                           "Width %d pitch %d: pixel (%d,%d) differs.",
+                           (int)width,
+                           (int)pitch,
+                           (int)x,
+                           (int)y);
+                }
+            }
+            CHECK(dst.back() == 0xcdcd);
+        }
+    }
+}
+
+static void
+configure(struct Camera* camera, uint32_t width, uint32_t height)
+{
+    CameraProperties props = {};
+    DEVOK(camera->get(camera, &props));
+    props.pixel_type = SampleType_u12;
+    props.shape = { .x = width, .y = height };
+    DEVOK(camera->set(camera, &props));
+    DEVOK(camera->get(camera, &props));
+    CHECK(props.pixel_type == SampleType_u12);
+}
+
+/// Grabs a frame and checks it against the stub's pixel pattern.
+/// `width` is in pixels.
+static void
+check_frame(struct Camera* camera, uint32_t width, uint32_t height)
+{
+    const size_t nbytes_expected = (size_t)width * height * 2;
+    ImageShape shape = {};
+    DEVOK(camera->get_shape(camera, &shape));
+    CHECK(shape.type == SampleType_u12);
+    CHECK(shape.dims.width == width);
+    CHECK(shape.strides.height == width);
+
+    DEVOK(camera->start(camera));
+    std::vector<uint16_t> im((size_t)width * height + 1, 0xcdcd);
+    size_t nbytes = 0;
+    ImageInfo info = {};
+    DEVOK(camera->get_frame(camera, im.data(), &nbytes, &info));
+    EXPECT(nbytes == nbytes_expected,
+           "Expected %d bytes. Got %d.",
+           (int)nbytes_expected,
+           (int)nbytes);
+    CHECK(im.back() == 0xcdcd);
+    const auto stamp = (int32_t)info.hardware_frame_id;
+    for (uint32_t y = 0; y < height; ++y) {
+        for (uint32_t x = 0; x < width; ++x) {
+            EXPECT(im[(size_t)y * width + x] ==
+                     (dcamstub_pixel(stamp, x, y) & 0x0fff),
+                   "Unexpected value at (%d,%d)",
+                   x,
+                   y);
+        }
+    }
+    DEVOK(camera->stop(camera));
+}
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        check_kernel();
+
+        dcamstub_reset();
+        dcamstub_set_row_padding(24);
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+
+        {
+            CameraPropertyMetadata meta = {};
+            DEVOK(camera->get_meta(camera, &meta));
+            CHECK(meta.supported_pixel_types & (1 << SampleType_u12));
+        }
+
+        // Packed on the wire, unpacked by the driver.
+        configure(camera, 61, 7);
+        check_frame(camera, 61, 7);
+        configure(camera, 256, 16);
+        check_frame(camera, 256, 16);
+
+        // Packed rows pass through untouched.
+        {
+            const uint32_t width = 61, height = 7;
+            const size_t row_bytes = (3 * width + 1) / 2;
+            configure(camera, width, height);
+            Dcam4Options options = {};
+            DEVOK(aq_dcam_get_options(camera, &options));
+            options.pass_through_mono12p = 1;
+            DEVOK(aq_dcam_set_options(camera, &options));
+
+            ImageShape shape = {};
+            DEVOK(camera->get_shape(camera, &shape));
+            CHECK(shape.type == SampleType_u8);
+            CHECK(shape.dims.width == row_bytes);
+
+            DEVOK(camera->start(camera));
+            std::vector<uint8_t> im(row_bytes * height);
+            size_t nbytes = 0;
+            ImageInfo info = {};
+            DEVOK(camera->get_frame(camera, im.data(), &nbytes, &info));
+            CHECK(nbytes == row_bytes * height);
+            const auto stamp = (int32_t)info.hardware_frame_id;
+            for (uint32_t y = 0; y < height; ++y) {
+                for (uint32_t x = 0; x < width; ++x) {
+                    EXPECT(unpack_one(im.data() + y * row_bytes, x) ==
+                             (dcamstub_pixel(stamp, x, y) & 0x0fff),
+                           "Unexpected value at (%d,%d)",
+                           x,
+                           y);
+                }
+            }
+
+            // Locked frames are always described as they sit in the ring.
+            Dcam4Frame frame = {};
+            DEVOK(aq_dcam_lock_frame(camera, &frame));
+            CHECK(frame.info.shape.type == SampleType_u8);
+            CHECK(frame.info.shape.dims.width == row_bytes);
+            DEVOK(aq_dcam_unlock_frame(camera, &frame));
+            DEVOK(camera->stop(camera));
+
+            options.pass_through_mono12p = 0;
+            DEVOK(aq_dcam_set_options(camera, &options));
+        }
+
+        // Cameras without the packed format fall back to 12 bits in 16.
+        dcamstub_set_mono12p_supported(0);
+        configure(camera, 61, 7);
+        check_frame(camera, 61, 7);
+
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
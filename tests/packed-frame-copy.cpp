@@ -0,0 +1,219 @@
+/// Frames should come out of get_frame packed tightly, as get_shape
+/// describes them, even when the DCAM ring pads its rows. Also compares the
+/// driver's copy with dcambuf_copyframe().
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+#include "dcam.copy.h"
+#include "platform.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+/// Compares copy_packed_rows() against a row-by-row memcpy for row sizes
+/// around the vector width and a range of paddings.
+static void
+check_kernel()
+{
+    const size_t height = 5;
+    for (size_t row_bytes = 1; row_bytes <= 300; ++row_bytes) {
+        for (size_t padding : { 0, 1, 7, 32, 61 }) {
+            const size_t pitch = row_bytes + padding;
+            std::vector<uint8_t> src(pitch * height);
+            for (size_t i = 0; i < src.size(); ++i)
+                src[i] = (uint8_t)(i * 13 + 5);
+            // One extra byte to catch writes past the end.
+            std::vector<uint8_t> dst(row_bytes * height + 1, 0xcd);
+            copy_packed_rows(dst.data(), src.data(), row_bytes, pitch, height);
+            for (size_t y = 0; y < height; ++y) {
+                EXPECT(0 == memcmp(dst.data() + y * row_bytes,
+                                   src.data() + y * pitch,
+                                   row_bytes),
+                       "Row %d differs for %d bytes per row with a pitch of "
+                       "%d.",
+                       (int)y,
+                       (int)row_bytes,
+                       (int)pitch);
+            }
+            CHECK(dst.back() == 0xcd);
+        }
+    }
+}
+
+static void
+check_get_frame(struct Camera* camera,
+                SampleType type,
+                uint32_t width,
+                uint32_t height)
+{
+    const size_t bpp = type == SampleType_u8 ? 1 : 2;
+    CameraProperties props = {};
+    DEVOK(camera->get(camera, &props));
+    props.pixel_type = type;
+    props.shape = { .x = width, .y = height };
+    DEVOK(camera->set(camera, &props));
+
+    ImageShape shape = {};
+    DEVOK(camera->get_shape(camera, &shape));
+    CHECK(shape.strides.height == width);
+
+    DEVOK(camera->start(camera));
+    std::vector<uint8_t> im(width * height * bpp + 1, 0xcd);
+    size_t nbytes = 0;
+    ImageInfo info = {};
+    DEVOK(camera->get_frame(camera, im.data(), &nbytes, &info));
+    EXPECT(nbytes == width * height * bpp,
+           "Expected %d bytes. Got %d.",
+           (int)(width * height * bpp),
+           (int)nbytes);
+    CHECK(im.back() == 0xcd);
+
+    const auto stamp = (int32_t)info.hardware_frame_id;
+    for (uint32_t y = 0; y < height; ++y) {
+        for (uint32_t x = 0; x < width; ++x) {
+            const size_t i = (size_t)y * width + x;
+            const uint16_t expected = dcamstub_pixel(stamp, x, y);
+            const uint16_t v =
+              bpp == 1 ? im[i] : ((const uint16_t*)im.data())[i];
+            EXPECT(v == (bpp == 1 ? (uint8_t)expected : expected),
+                   "%dx%d: unexpected value at (%d,%d)",
+                   width,
+                   height,
+                   x,
+                   y);
+        }
+    }
+    DEVOK(camera->stop(camera));
+}
+
+/// Times full-size frames through get_frame() and through
+/// dcambuf_copyframe() into a packed buffer. Reported, not checked: the
+/// timing depends on the machine.
+static void
+benchmark(struct Camera* camera)
+{
+    const uint32_t width = 2304, height = 2304;
+    const int nframes = 50;
+    CameraProperties props = {};
+    DEVOK(camera->get(camera, &props));
+    props.pixel_type = SampleType_u16;
+    props.shape = { .x = width, .y = height };
+    DEVOK(camera->set(camera, &props));
+    std::vector<uint8_t> im((size_t)width * height * 2);
+
+    DEVOK(camera->start(camera));
+    double ms_kernel = 0.0, ms_copyframe = 0.0;
+    {
+        // Camera is the first member of Dcam4Camera.
+        const HDCAM hdcam = ((struct Dcam4Camera*)camera)->hdcam;
+        for (int i = 0; i < nframes; ++i) {
+            size_t nbytes = 0;
+            ImageInfo info = {};
+            // Produces the frame, so the copies below see the same one.
+            DEVOK(camera->get_frame(camera, im.data(), &nbytes, &info));
+
+            struct clock clock = {};
+            DCAMBUF_FRAME frame = {};
+            frame.size = sizeof(frame);
+            frame.iFrame = -1;
+            CHECK(DCAMERR_SUCCESS == dcambuf_lockframe(hdcam, &frame));
+            clock_init(&clock);
+            copy_packed_rows(
+              im.data(), frame.buf, (size_t)width * 2, frame.rowbytes, height);
+            ms_kernel += clock_toc_ms(&clock);
+
+            frame = {};
+            frame.size = sizeof(frame);
+            frame.iFrame = -1;
+            frame.buf = im.data();
+            frame.rowbytes = (int32)(width * 2);
+            frame.width = (int32)width;
+            frame.height = (int32)height;
+            clock_init(&clock);
+            CHECK(DCAMERR_SUCCESS == dcambuf_copyframe(hdcam, &frame));
+            ms_copyframe += clock_toc_ms(&clock);
+        }
+    }
+    DEVOK(camera->stop(camera));
+
+    const double mb = (double)width * height * 2 * nframes / (1 << 20);
+    LOG("copy_packed_rows:   %8.3f ms/frame %8.1f MB/s",
+        ms_kernel / nframes,
+        1e3 * mb / ms_kernel);
+    LOG("dcambuf_copyframe:  %8.3f ms/frame %8.1f MB/s",
+        ms_copyframe / nframes,
+        1e3 * mb / ms_copyframe);
+}
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        check_kernel();
+
+        dcamstub_reset();
+        dcamstub_set_row_padding(24);
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+
+        check_get_frame(camera, SampleType_u16, 64, 48);
+        check_get_frame(camera, SampleType_u16, 61, 7);
+        check_get_frame(camera, SampleType_u8, 63, 9);
+
+        // No padding takes the contiguous path.
+        dcamstub_set_row_padding(0);
+        check_get_frame(camera, SampleType_u16, 64, 48);
+
+        dcamstub_set_row_padding(64);
+        benchmark(camera);
+
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
@@ -0,0 +1,132 @@
+/// aq_dcam_get() should answer from the properties the driver last read or
+/// wrote, without calling into DCAM, until a refresh is asked for or a change
+/// may have had side effects on the camera.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <cstring>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+static bool
+is_same(const CameraProperties& a, const CameraProperties& b)
+{
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+static uint64_t
+dcam_reads()
+{
+    return dcamstub_get_calls()->getvalue + dcamstub_get_calls()->getattr;
+}
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        dcamstub_reset();
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+
+        // The properties read on open are remembered.
+        CameraProperties props = {};
+        dcamstub_clear_calls();
+        DEVOK(camera->get(camera, &props));
+        CHECK(dcam_reads() == 0);
+
+        // So are the ones written.
+        props.pixel_type = SampleType_u16;
+        props.shape = { .x = 64, .y = 48 };
+        props.offset = { .x = 8, .y = 4 };
+        props.exposure_time_us = 2000.0f;
+        props.input_triggers.frame_start.enable = 1;
+        props.input_triggers.frame_start.line = 4;
+        props.input_triggers.frame_start.kind = Signal_Input;
+        DEVOK(camera->set(camera, &props));
+        {
+            CameraProperties cached = {};
+            dcamstub_clear_calls();
+            DEVOK(camera->get(camera, &cached));
+            CHECK(dcam_reads() == 0);
+            CHECK(is_same(cached, props));
+
+            // What the camera reports agrees with them.
+            CameraProperties actual = {};
+            DEVOK(aq_dcam_refresh(camera, &actual));
+            CHECK(dcam_reads() > 0);
+            CHECK(is_same(actual, cached));
+        }
+
+        // Binning may change other properties, so they're read again.
+        props.binning = 2;
+        DEVOK(camera->set(camera, &props));
+        dcamstub_clear_calls();
+        DEVOK(camera->get(camera, &props));
+        CHECK(dcam_reads() > 0);
+        CHECK(props.binning == 2);
+        dcamstub_clear_calls();
+        DEVOK(camera->get(camera, &props));
+        CHECK(dcam_reads() == 0);
+
+        // Output triggers are applied, and remembered, on their own.
+        props.output_triggers.exposure.enable = 1;
+        props.output_triggers.exposure.line = 1;
+        props.output_triggers.exposure.kind = Signal_Output;
+        DEVOK(camera->set(camera, &props));
+        {
+            CameraProperties actual = {};
+            DEVOK(aq_dcam_refresh(camera, &actual));
+            CHECK(actual.output_triggers.exposure.enable);
+            CHECK(actual.output_triggers.exposure.line == 1);
+        }
+
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
@@ -0,0 +1,146 @@
+/// When reopening a failed camera doesn't help, the driver restarts DCAM,
+/// retrying with exponential backoff until a deadline, and reports how
+/// recovery went.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        dcamstub_reset();
+        dcamstub_set_device_count(2);
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Camera* cameras[2] = {};
+        for (uint64_t i = 0; i < 2; ++i) {
+            struct Device* device = 0;
+            DEVOK(driver->open(driver, i, &device));
+            // The runtime records the identifier of each device it opens.
+            DEVOK(driver->describe(driver, &device->identifier, i));
+            cameras[i] = (struct Camera*)device;
+
+            CameraProperties props = {};
+            DEVOK(cameras[i]->get(cameras[i], &props));
+            props.pixel_type = SampleType_u16;
+            props.shape = { .x = 48 + 16 * (uint32_t)i, .y = 32 };
+            DEVOK(cameras[i]->set(cameras[i], &props));
+        }
+
+        // Reopening the camera fails, and so do the first three restarts.
+        // They're retried after 20, 40 and 80 ms.
+        dcamstub_fault_device(0);
+        dcamstub_fail_open(1);
+        dcamstub_fail_init(3);
+        DEVOK(cameras[0]->start(cameras[0]));
+
+        Dcam4Status status = {};
+        DEVOK(aq_dcam_get_status(cameras[0], &status));
+        CHECK(status.recovery.count == 1);
+        CHECK(status.recovery.resets == 1);
+        CHECK(status.recovery.failed == 0);
+        CHECK(status.recovery.last_attempts == 4);
+        EXPECT(status.recovery.last_ms >= 140.0f &&
+                 status.recovery.last_ms < 2000.0f,
+               "Recovery took %f ms",
+               status.recovery.last_ms);
+        CHECK(status.recovery.max_ms == status.recovery.last_ms);
+
+        {
+            Dcam4Frame frame = {};
+            DEVOK(aq_dcam_lock_frame(cameras[0], &frame));
+            CHECK(frame.info.shape.dims.width == 48);
+            DEVOK(aq_dcam_unlock_frame(cameras[0], &frame));
+        }
+        DEVOK(cameras[0]->stop(cameras[0]));
+
+        // The other camera was reopened with its properties.
+        {
+            CHECK(cameras[1]->state == DeviceState_Armed);
+            CameraProperties props = {};
+            DEVOK(cameras[1]->get(cameras[1], &props));
+            CHECK(props.shape.x == 64);
+        }
+
+        // A camera that is gone after the restart isn't recovered.
+        dcamstub_set_device_count(1);
+        dcamstub_fault_device(1);
+        CHECK(Device_Err == cameras[1]->start(cameras[1]));
+        CHECK(cameras[1]->state == DeviceState_Closed);
+        DEVOK(aq_dcam_get_status(cameras[1], &status));
+        CHECK(status.recovery.failed == 1);
+
+        // Give up once the deadline passes.
+        Dcam4Options options = {};
+        DEVOK(aq_dcam_get_options(cameras[0], &options));
+        options.recovery_max_backoff_ms = 50.0f;
+        options.recovery_deadline_ms = 100.0f;
+        DEVOK(aq_dcam_set_options(cameras[0], &options));
+        dcamstub_fault_device(0);
+        dcamstub_fail_open(1);
+        dcamstub_fail_init(1000);
+        CHECK(Device_Err == cameras[0]->start(cameras[0]));
+
+        DEVOK(aq_dcam_get_status(cameras[0], &status));
+        CHECK(status.recovery.count == 2);
+        CHECK(status.recovery.resets == 2);
+        CHECK(status.recovery.failed == 1);
+        CHECK(status.recovery.last_attempts >= 3);
+        EXPECT(status.recovery.last_ms >= 100.0f &&
+                 status.recovery.last_ms < 1000.0f,
+               "Recovery took %f ms",
+               status.recovery.last_ms);
+        CHECK(cameras[0]->state == DeviceState_Closed);
+
+        dcamstub_fail_init(0);
+        for (auto camera : cameras)
+            DEVOK(driver->close(driver, &camera->device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
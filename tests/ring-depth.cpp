@@ -0,0 +1,118 @@
+/// The DCAM capture ring depth can be fixed, or sized from the frame
+/// interval within a memory budget.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        dcamstub_reset();
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+
+        CameraProperties props = {};
+        DEVOK(camera->get(camera, &props));
+        props.pixel_type = SampleType_u16;
+        props.shape = { .x = 64, .y = 48 };
+        props.exposure_time_us = 1000.0f;
+        DEVOK(camera->set(camera, &props));
+        const uint64_t bytes_of_frame = 64 * 48 * 2;
+
+        Dcam4Options options = {};
+        Dcam4Status status = {};
+        DEVOK(aq_dcam_get_options(camera, &options));
+        CHECK(options.ring_depth == 10);
+
+        // Fixed depth
+        options.ring_depth = 25;
+        DEVOK(aq_dcam_set_options(camera, &options));
+        DEVOK(camera->start(camera));
+        DEVOK(aq_dcam_get_status(camera, &status));
+        CHECK(status.ring.depth == 25);
+        CHECK(status.ring.bytes == 25 * bytes_of_frame);
+        DEVOK(camera->stop(camera));
+
+        // Auto: enough frames for the requested duration at 1 ms per frame.
+        options.ring_depth = 0;
+        options.ring_duration_ms = 250.0f;
+        options.ring_max_bytes = 1ULL << 30;
+        DEVOK(aq_dcam_set_options(camera, &options));
+        DEVOK(camera->start(camera));
+        DEVOK(aq_dcam_get_status(camera, &status));
+        EXPECT(status.ring.depth == 250,
+               "Expected 250 frames. Got %d.",
+               status.ring.depth);
+        CHECK(status.ring.bytes == 250 * bytes_of_frame);
+        DEVOK(camera->stop(camera));
+
+        // Auto: limited by the memory budget.
+        options.ring_max_bytes = 40 * bytes_of_frame + 1;
+        DEVOK(aq_dcam_set_options(camera, &options));
+        DEVOK(camera->start(camera));
+        DEVOK(aq_dcam_get_status(camera, &status));
+        EXPECT(status.ring.depth == 40,
+               "Expected 40 frames. Got %d.",
+               status.ring.depth);
+        CHECK(status.ring.bytes <= options.ring_max_bytes);
+        DEVOK(camera->stop(camera));
+
+        // Bad settings are rejected and leave the options unchanged.
+        options.ring_depth = -1;
+        CHECK(Device_Err == aq_dcam_set_options(camera, &options));
+        DEVOK(aq_dcam_get_options(camera, &options));
+        CHECK(options.ring_depth == 0);
+
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
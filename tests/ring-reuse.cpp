@@ -0,0 +1,151 @@
+/// The capture ring is kept across stop and start, and only reallocated when
+/// the frame layout or the ring options change.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+/// Starts capture, checks a few frames of `width` pixels, and stops.
+static void
+burst(struct Camera* camera, int32_t width)
+{
+    DEVOK(camera->start(camera));
+    for (int i = 0; i < 3; ++i) {
+        Dcam4Frame frame = {};
+        DEVOK(aq_dcam_lock_frame(camera, &frame));
+        CHECK(frame.info.shape.dims.width == (uint32_t)width);
+        const auto stamp = (int32_t)frame.info.hardware_frame_id;
+        const auto row =
+          (const uint16_t*)((const uint8_t*)frame.data + 5 * frame.pitch);
+        CHECK(row[width - 1] == dcamstub_pixel(stamp, width - 1, 5));
+        DEVOK(aq_dcam_unlock_frame(camera, &frame));
+    }
+    DEVOK(camera->stop(camera));
+}
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        dcamstub_reset();
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+
+        CameraProperties props = {};
+        DEVOK(camera->get(camera, &props));
+        props.pixel_type = SampleType_u16;
+        props.shape = { .x = 64, .y = 48 };
+        DEVOK(camera->set(camera, &props));
+
+        // Repeated bursts share one ring.
+        dcamstub_clear_calls();
+        for (int i = 0; i < 3; ++i)
+            burst(camera, 64);
+        CHECK(dcamstub_get_calls()->alloc == 1);
+        CHECK(dcamstub_get_calls()->release == 0);
+
+        Dcam4Status status = {};
+        DEVOK(aq_dcam_get_status(camera, &status));
+        CHECK(status.ring.allocations == 1);
+        CHECK(status.ring.reuses == 2);
+
+        // Timing doesn't change the frame layout.
+        props.exposure_time_us *= 2.0f;
+        DEVOK(camera->set(camera, &props));
+        burst(camera, 64);
+        CHECK(dcamstub_get_calls()->alloc == 1);
+        CHECK(dcamstub_get_calls()->release == 0);
+
+        // While capture runs, timing can still change, but the frame layout
+        // can't, since that would release a ring DCAM is writing to.
+        DEVOK(camera->start(camera));
+        {
+            CameraProperties running = props;
+            running.exposure_time_us *= 2.0f;
+            DEVOK(camera->set(camera, &running));
+            running.shape = { .x = 32, .y = 16 };
+            CHECK(Device_Err == camera->set(camera, &running));
+        }
+        DEVOK(camera->stop(camera));
+        CHECK(dcamstub_get_calls()->release == 0);
+
+        // A new ROI does. The kept ring is released before it's written.
+        props.shape = { .x = 32, .y = 16 };
+        DEVOK(camera->set(camera, &props));
+        CHECK(dcamstub_get_calls()->release == 1);
+        burst(camera, 32);
+        burst(camera, 32);
+        CHECK(dcamstub_get_calls()->alloc == 2);
+
+        // So does a different ring depth.
+        Dcam4Options options = {};
+        DEVOK(aq_dcam_get_options(camera, &options));
+        options.ring_depth += 1;
+        DEVOK(aq_dcam_set_options(camera, &options));
+        burst(camera, 32);
+        CHECK(dcamstub_get_calls()->alloc == 3);
+        CHECK(dcamstub_get_calls()->release == 2);
+
+        // And a switch to a ring the driver allocates.
+        options.allocation = Dcam4Allocation_Driver;
+        DEVOK(aq_dcam_set_options(camera, &options));
+        burst(camera, 32);
+        burst(camera, 32);
+        CHECK(dcamstub_get_calls()->attach == 1);
+        CHECK(dcamstub_get_calls()->release == 3);
+
+        DEVOK(aq_dcam_get_status(camera, &status));
+        CHECK(status.ring.allocations == 4);
+        CHECK(status.ring.reuses == 6);
+
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
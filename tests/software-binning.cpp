@@ -0,0 +1,305 @@
+/// Software binning and decimation should combine with the camera's own
+/// binning and the other processing stages, and get_shape should describe
+/// the result.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+#include "dcam.copy.h"
+
+#include <cstdio>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+/// Bins the pixels given by `at` one block at a time.
+static uint32_t
+reference(std::function<uint32_t(size_t, size_t)> at,
+          const binning& b,
+          size_t ox,
+          size_t oy,
+          uint32_t max)
+{
+    uint32_t sum = 0;
+    for (size_t y = 0; y < b.bin_y; ++y)
+        for (size_t x = 0; x < b.bin_x; ++x)
+            sum += at(ox * b.bin_x * b.step_x + x, oy * b.bin_y * b.step_y + y);
+    const uint32_t n = (uint32_t)(b.bin_x * b.bin_y);
+    if (b.is_mean)
+        sum = (sum + n / 2) / n;
+    return sum < max ? sum : max;
+}
+
+static void
+check_kernel()
+{
+    CHECK(binned_size(10, 2, 1) == 5);
+    CHECK(binned_size(10, 2, 2) == 3);
+    CHECK(binned_size(10, 3, 1) == 3);
+    CHECK(binned_size(2, 3, 1) == 0);
+
+    const size_t width = 37, height = 23;
+    const binning cases[] = {
+        { 2, 2, 1, 1, 1 }, { 3, 2, 1, 1, 0 }, { 1, 1, 2, 3, 0 },
+        { 4, 3, 2, 1, 1 }, { 1, 4, 1, 1, 0 }, { 16, 1, 1, 2, 0 },
+    };
+    for (size_t bytes_per_pixel : { 1, 2 }) {
+        const size_t pitch = bytes_per_pixel * width + 10;
+        std::vector<uint8_t> src(pitch * height);
+        for (size_t y = 0; y < height; ++y) {
+            for (size_t x = 0; x < width; ++x) {
+                const uint32_t v = (uint32_t)(x * 2711 + y * 523);
+                uint8_t* row = src.data() + y * pitch;
+                if (bytes_per_pixel == 1)
+                    row[x] = (uint8_t)v;
+                else
+                    ((uint16_t*)row)[x] = (uint16_t)(v * 7);
+            }
+        }
+        auto at = [&](size_t x, size_t y) -> uint32_t {
+            const uint8_t* row = src.data() + y * pitch;
+            return bytes_per_pixel == 1 ? row[x] : ((const uint16_t*)row)[x];
+        };
+        const uint32_t max = bytes_per_pixel == 1 ? 255 : 65535;
+
+        for (const auto& b : cases) {
+            const size_t ow = binned_size(width, b.bin_x, b.step_x);
+            const size_t oh = binned_size(height, b.bin_y, b.step_y);
+            std::vector<uint8_t> dst(ow * oh * bytes_per_pixel);
+            std::vector<uint32_t> acc(width);
+            bin_rows(dst.data(),
+                     src.data(),
+                     width,
+                     pitch,
+                     height,
+                     bytes_per_pixel,
+                     &b,
+                     acc.data());
+            for (size_t oy = 0; oy < oh; ++oy) {
+                for (size_t ox = 0; ox < ow; ++ox) {
+                    const size_t i = oy * ow + ox;
+                    const uint32_t v = bytes_per_pixel == 1
+                                         ? dst[i]
+                                         : ((const uint16_t*)dst.data())[i];
+                    EXPECT(v == reference(at, b, ox, oy, max),
+                           "%dx%d bins, %dx%d steps, %d bytes per pixel: "
+                           "pixel (%d,%d) differs.",
+                           (int)b.bin_x,
+                           (int)b.bin_y,
+                           (int)b.step_x,
+                           (int)b.step_y,
+                           (int)bytes_per_pixel,
+                           (int)ox,
+                           (int)oy);
+                }
+            }
+        }
+    }
+}
+
+static void
+set_binning(struct Camera* camera,
+            uint8_t bin_x,
+            uint8_t bin_y,
+            uint8_t step_x,
+            uint8_t step_y)
+{
+    Dcam4Options options = {};
+    DEVOK(aq_dcam_get_options(camera, &options));
+    options.sw_bin_x = bin_x;
+    options.sw_bin_y = bin_y;
+    options.sw_decimate_x = step_x;
+    options.sw_decimate_y = step_y;
+    DEVOK(aq_dcam_set_options(camera, &options));
+}
+
+/// Grabs a frame and checks it against the stub's pixel pattern binned
+/// with the current options. `width` and `height` are the size of the
+/// frames the camera sends. `pixel` maps a binned 16-bit value to the value
+/// expected in the frame.
+static void
+check_frame(struct Camera* camera,
+            SampleType type,
+            uint32_t width,
+            uint32_t height,
+            std::function<uint32_t(uint32_t)> pixel)
+{
+    Dcam4Options options = {};
+    DEVOK(aq_dcam_get_options(camera, &options));
+    const binning b = {
+        options.sw_bin_x,      options.sw_bin_y,
+        options.sw_decimate_x, options.sw_decimate_y,
+        options.sw_bin_mode == Dcam4BinMode_Mean,
+    };
+    const size_t ow = binned_size(width, b.bin_x, b.step_x);
+    const size_t oh = binned_size(height, b.bin_y, b.step_y);
+    const size_t bytes_per_pixel = type == SampleType_u8 ? 1 : 2;
+
+    ImageShape shape = {};
+    DEVOK(camera->get_shape(camera, &shape));
+    CHECK(shape.type == type);
+    EXPECT(shape.dims.width == ow && shape.dims.height == oh,
+           "Expected a %dx%d frame. Got %dx%d.",
+           (int)ow,
+           (int)oh,
+           (int)shape.dims.width,
+           (int)shape.dims.height);
+    CHECK(shape.strides.height == ow);
+
+    DEVOK(camera->start(camera));
+    std::vector<uint8_t> im(ow * oh * bytes_per_pixel);
+    size_t nbytes = 0;
+    ImageInfo info = {};
+    DEVOK(camera->get_frame(camera, im.data(), &nbytes, &info));
+    CHECK(nbytes == im.size());
+    const auto stamp = (int32_t)info.hardware_frame_id;
+    // The camera's pixels before any software processing.
+    auto at = [&](size_t x, size_t y) -> uint32_t {
+        const uint16_t v = dcamstub_pixel(stamp, (int32_t)x, (int32_t)y);
+        return type == SampleType_u12 ? (v & 0x0fff) : v;
+    };
+    for (size_t oy = 0; oy < oh; ++oy) {
+        for (size_t ox = 0; ox < ow; ++ox) {
+            const size_t i = oy * ow + ox;
+            const uint32_t v =
+              bytes_per_pixel == 1 ? im[i] : ((const uint16_t*)im.data())[i];
+            EXPECT(v == pixel(reference(at, b, ox, oy, 65535)),
+                   "Unexpected value at (%d,%d)",
+                   (int)ox,
+                   (int)oy);
+        }
+    }
+    DEVOK(camera->stop(camera));
+}
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        check_kernel();
+
+        dcamstub_reset();
+        dcamstub_set_row_padding(24);
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+
+        CameraProperties props = {};
+        DEVOK(camera->get(camera, &props));
+        props.pixel_type = SampleType_u16;
+        props.shape = { .x = 100, .y = 60 };
+        DEVOK(camera->set(camera, &props));
+
+        auto same = [](uint32_t v) { return v; };
+        set_binning(camera, 2, 3, 1, 1);
+        check_frame(camera, SampleType_u16, 100, 60, same);
+        set_binning(camera, 1, 1, 3, 2);
+        check_frame(camera, SampleType_u16, 100, 60, same);
+        set_binning(camera, 2, 2, 2, 2);
+        check_frame(camera, SampleType_u16, 100, 60, same);
+
+        // On top of the camera's binning. The stub's pixel pattern doesn't
+        // depend on it, only the frame size does.
+        props.binning = 2;
+        DEVOK(camera->set(camera, &props));
+        set_binning(camera, 2, 2, 1, 1);
+        check_frame(camera, SampleType_u16, 50, 30, same);
+        props.binning = 1;
+        DEVOK(camera->set(camera, &props));
+
+        // Before the conversion to 8 bits.
+        {
+            Dcam4Options options = {};
+            DEVOK(aq_dcam_get_options(camera, &options));
+            options.u8_source = Dcam4U8Source_Shift;
+            options.u8_shift = 1;
+            DEVOK(aq_dcam_set_options(camera, &options));
+            props.pixel_type = SampleType_u8;
+            DEVOK(camera->set(camera, &props));
+            set_binning(camera, 3, 3, 1, 1);
+            check_frame(
+              camera, SampleType_u8, 100, 60, [](uint32_t v) -> uint32_t {
+                  return (v >> 1) < 255 ? (v >> 1) : 255;
+              });
+        }
+
+        // After unpacking 12-bit pixels.
+        props.pixel_type = SampleType_u12;
+        DEVOK(camera->set(camera, &props));
+        set_binning(camera, 2, 2, 1, 1);
+        check_frame(camera, SampleType_u12, 100, 60, same);
+
+        // Sums instead of means.
+        {
+            props.pixel_type = SampleType_u16;
+            DEVOK(camera->set(camera, &props));
+            Dcam4Options options = {};
+            DEVOK(aq_dcam_get_options(camera, &options));
+            options.sw_bin_mode = Dcam4BinMode_Sum;
+            DEVOK(aq_dcam_set_options(camera, &options));
+            set_binning(camera, 4, 4, 1, 1);
+            check_frame(camera, SampleType_u16, 100, 60, same);
+
+            options.sw_bin_x = 0;
+            CHECK(Device_Err == aq_dcam_set_options(camera, &options));
+        }
+
+        // The frame size can't change while capture runs.
+        {
+            DEVOK(camera->start(camera));
+            Dcam4Options options = {};
+            DEVOK(aq_dcam_get_options(camera, &options));
+            options.sw_bin_x = 1;
+            CHECK(Device_Err == aq_dcam_set_options(camera, &options));
+            options.sw_bin_x = 4;
+            options.sw_bin_mode = Dcam4BinMode_Mean;
+            DEVOK(aq_dcam_set_options(camera, &options));
+            DEVOK(camera->stop(camera));
+        }
+
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
@@ -0,0 +1,140 @@
+/// With software triggering selected, firing a trigger should be a single
+/// DCAM call. Other trigger sources still accept software triggers by
+/// switching the source around the call.
+///
+/// Also reports the latency of aq_dcam_fire_software_trigger() against the
+/// stub, which is the driver's own overhead per trigger.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+#include "platform.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+static void
+set_frame_start_trigger(struct Camera* camera, uint8_t enable, uint8_t line)
+{
+    CameraProperties props = {};
+    DEVOK(camera->get(camera, &props));
+    props.input_triggers.frame_start.enable = enable;
+    props.input_triggers.frame_start.line = line;
+    props.input_triggers.frame_start.kind = Signal_Input;
+    DEVOK(camera->set(camera, &props));
+}
+
+static double
+time_triggers_ns(struct Camera* camera, int ntriggers)
+{
+    struct clock clock = {};
+    clock_init(&clock);
+    for (int i = 0; i < ntriggers; ++i)
+        DEVOK(camera->execute_trigger(camera));
+    return 1e6 * clock_toc_ms(&clock) / ntriggers;
+}
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        const int ntriggers = 1000;
+        const int32_t line_software = 4;
+        dcamstub_reset();
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+
+        // Software trigger selected: just the trigger.
+        set_frame_start_trigger(camera, 1, line_software);
+        dcamstub_clear_calls();
+        for (int i = 0; i < ntriggers; ++i)
+            DEVOK(camera->execute_trigger(camera));
+        {
+            const auto calls = dcamstub_get_calls();
+            CHECK(calls->firetrigger == ntriggers);
+            CHECK(calls->getvalue == 0);
+            CHECK(calls->setvalue == 0);
+        }
+        const double ns_software = time_triggers_ns(camera, 100000);
+
+        // External trigger selected: the source is switched to software and
+        // back, but never read.
+        set_frame_start_trigger(camera, 1, 0);
+        dcamstub_clear_calls();
+        for (int i = 0; i < ntriggers; ++i)
+            DEVOK(camera->execute_trigger(camera));
+        {
+            const auto calls = dcamstub_get_calls();
+            CHECK(calls->firetrigger == ntriggers);
+            CHECK(calls->getvalue == 0);
+            CHECK(calls->setvalue == 2 * ntriggers);
+        }
+        const double ns_external = time_triggers_ns(camera, 100000);
+
+        // Querying the properties refreshes the remembered source.
+        {
+            CameraProperties props = {};
+            DEVOK(camera->get(camera, &props));
+            CHECK(props.input_triggers.frame_start.enable);
+            CHECK(props.input_triggers.frame_start.line == 0);
+        }
+
+        // Triggering disabled: the camera runs on its internal trigger.
+        set_frame_start_trigger(camera, 0, 0);
+        dcamstub_clear_calls();
+        DEVOK(camera->execute_trigger(camera));
+        CHECK(dcamstub_get_calls()->getvalue == 0);
+        CHECK(dcamstub_get_calls()->setvalue == 2);
+
+        LOG("Software trigger selected: %8.1f ns/trigger", ns_software);
+        LOG("External trigger selected: %8.1f ns/trigger", ns_external);
+
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
@@ -0,0 +1,788 @@
+//! A stand-in for the DCAM-API runtime so the driver can be exercised
+//! without a camera attached.
+//!
+//! Frames are synthesized on demand: each call to dcamwait_start() writes
+//! the next frame(s) into the capture ring, so tests are deterministic and
+//! single threaded.
+#include "dcamapi.stub.h"
+
+#include <dcamprop.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define countof(e) (sizeof(e) / sizeof(*(e)))
+
+#define MAX_DEVICES 16
+#define MAX_PROPS 128
+#define ARRAY_ELEMENT_STEP 0x01000000
+#define SENSOR_PIXELS 2304 // width and height
+
+struct prop
+{
+    int32 id;
+    double value;
+};
+
+struct device
+{
+    int is_open;
+    int32 index;
+
+    struct prop props[MAX_PROPS];
+    int nprops;
+
+    // capture ring
+    uint8_t* ring;    // allocated by dcambuf_alloc, otherwise 0
+    uint8_t** frames; // each frame in the ring, allocated or attached
+    int32* framestamps;
+    int32 depth;
+    int32 width, height, rowbytes, framebytes;
+    DCAM_PIXELTYPE type;
+
+    int is_capturing;
+    int is_faulted; // dcamcap_start fails until the device is reopened
+    int32 frame_count; // frames written since dcamcap_start
+    int32 framestamp;  // frames produced by the camera since dcamcap_start
+};
+
+static struct
+{
+    int is_initialized;
+    int32 device_count;
+    int32 row_padding;
+    int32 frames_per_wait;
+    int32 frames_to_lose;
+    int32 init_failures; // dcamapi_init calls left to fail
+    int32 open_failures; // dcamdev_open calls left to fail
+    int32 unreadable_prop; // dcamprop_getvalue fails for this property
+    int is_mono12p_unsupported;
+    struct device devices[MAX_DEVICES];
+    struct dcamstub_calls calls;
+} g = { .device_count = 1, .frames_per_wait = 1 };
+
+static struct device*
+as_device(HDCAM h)
+{
+    struct device* d = (struct device*)h;
+    if (d < g.devices || d >= g.devices + countof(g.devices) || !d->is_open)
+        return 0;
+    return d;
+}
+
+static struct prop*
+find_prop(struct device* d, int32 id)
+{
+    for (int i = 0; i < d->nprops; ++i)
+        if (d->props[i].id == id)
+            return d->props + i;
+    return 0;
+}
+
+static double
+get(struct device* d, int32 id)
+{
+    struct prop* p = find_prop(d, id);
+    return p ? p->value : 0.0;
+}
+
+static void
+put(struct device* d, int32 id, double value)
+{
+    struct prop* p = find_prop(d, id);
+    if (!p && d->nprops < MAX_PROPS) {
+        p = d->props + d->nprops++;
+        p->id = id;
+    }
+    if (p)
+        p->value = value;
+}
+
+/// Bytes of pixel data in a row, not counting padding.
+static int32
+bytes_of_row(DCAM_PIXELTYPE type, int32 width)
+{
+    switch (type) {
+        case DCAM_PIXELTYPE_MONO8:
+            return width;
+        case DCAM_PIXELTYPE_MONO12P:
+            return (3 * width + 1) / 2;
+        default:
+            return 2 * width;
+    }
+}
+
+static void
+init_props(struct device* d)
+{
+    d->nprops = 0;
+    put(d, DCAM_IDPROP_SUBARRAYHSIZE, SENSOR_PIXELS);
+    put(d, DCAM_IDPROP_SUBARRAYVSIZE, SENSOR_PIXELS);
+    put(d, DCAM_IDPROP_SUBARRAYHPOS, 0);
+    put(d, DCAM_IDPROP_SUBARRAYVPOS, 0);
+    put(d, DCAM_IDPROP_BINNING, 1);
+    put(d, DCAM_IDPROP_BINNING_INDEPENDENT, DCAMPROP_MODE__OFF);
+    put(d, DCAM_IDPROP_BINNING_HORZ, 1);
+    put(d, DCAM_IDPROP_BINNING_VERT, 1);
+    put(d, DCAM_IDPROP_IMAGE_PIXELTYPE, DCAM_PIXELTYPE_MONO16);
+    put(d, DCAM_IDPROP_EXPOSURETIME, 0.01);
+    put(d, DCAM_IDPROP_INTERNAL_LINEINTERVAL, 1e-5);
+    put(d, DCAM_IDPROP_READOUT_DIRECTION, DCAMPROP_READOUT_DIRECTION__FORWARD);
+    put(d, DCAM_IDPROP_TRIGGER_MODE, DCAMPROP_TRIGGER_MODE__NORMAL);
+    put(d, DCAM_IDPROP_TRIGGERSOURCE, DCAMPROP_TRIGGERSOURCE__INTERNAL);
+    put(d, DCAM_IDPROP_TRIGGERACTIVE, DCAMPROP_TRIGGERACTIVE__EDGE);
+    put(d, DCAM_IDPROP_TRIGGERPOLARITY, DCAMPROP_TRIGGERPOLARITY__POSITIVE);
+    put(d, DCAM_IDPROP_NUMBEROF_OUTPUTTRIGGERCONNECTOR, 3);
+    for (int32 i = 0; i < 3; ++i) {
+        const int32 offset = i * ARRAY_ELEMENT_STEP;
+        put(d,
+            DCAM_IDPROP_OUTPUTTRIGGER_KIND + offset,
+            DCAMPROP_OUTPUTTRIGGER_KIND__LOW);
+        put(d, DCAM_IDPROP_OUTPUTTRIGGER_SOURCE + offset, 0);
+        put(d,
+            DCAM_IDPROP_OUTPUTTRIGGER_POLARITY + offset,
+            DCAMPROP_OUTPUTTRIGGER_POLARITY__POSITIVE);
+    }
+}
+
+/// Whether writing `value` to `id` keeps the subarray on the sensor. Like
+/// the camera, the stub refuses writes that don't.
+static int
+is_subarray_on_sensor(struct device* d, int32 id, double value)
+{
+    int32 pos_id = 0, size_id = 0;
+    switch (id) {
+        case DCAM_IDPROP_SUBARRAYHPOS:
+        case DCAM_IDPROP_SUBARRAYHSIZE:
+            pos_id = DCAM_IDPROP_SUBARRAYHPOS;
+            size_id = DCAM_IDPROP_SUBARRAYHSIZE;
+            break;
+        case DCAM_IDPROP_SUBARRAYVPOS:
+        case DCAM_IDPROP_SUBARRAYVSIZE:
+            pos_id = DCAM_IDPROP_SUBARRAYVPOS;
+            size_id = DCAM_IDPROP_SUBARRAYVSIZE;
+            break;
+        default:
+            return 1;
+    }
+    const double pos = id == pos_id ? value : get(d, pos_id);
+    const double size = id == size_id ? value : get(d, size_id);
+    return pos + size <= SENSOR_PIXELS;
+}
+
+/// Whether `id` changes the layout of frames in the ring. Like the camera,
+/// the stub refuses writes to these while a buffer is allocated.
+static int
+is_buffer_property(int32 id)
+{
+    switch (id) {
+        case DCAM_IDPROP_SENSORMODE:
+        case DCAM_IDPROP_IMAGE_PIXELTYPE:
+        case DCAM_IDPROP_BINNING:
+        case DCAM_IDPROP_BINNING_INDEPENDENT:
+        case DCAM_IDPROP_BINNING_HORZ:
+        case DCAM_IDPROP_BINNING_VERT:
+        case DCAM_IDPROP_SUBARRAYMODE:
+        case DCAM_IDPROP_SUBARRAYHPOS:
+        case DCAM_IDPROP_SUBARRAYHSIZE:
+        case DCAM_IDPROP_SUBARRAYVPOS:
+        case DCAM_IDPROP_SUBARRAYVSIZE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/// Properties that are computed from other properties.
+static int
+get_derived(struct device* d, int32 id, double* out)
+{
+    const int is_independent = (int32)get(d, DCAM_IDPROP_BINNING_INDEPENDENT) ==
+                               DCAMPROP_MODE__ON;
+    const int32 binning = (int32)get(d, DCAM_IDPROP_BINNING);
+    const int32 binning_h =
+      is_independent ? (int32)get(d, DCAM_IDPROP_BINNING_HORZ) : binning;
+    const int32 binning_v =
+      is_independent ? (int32)get(d, DCAM_IDPROP_BINNING_VERT) : binning;
+    const int32 width = (int32)get(d, DCAM_IDPROP_SUBARRAYHSIZE) / binning_h;
+    const int32 height = (int32)get(d, DCAM_IDPROP_SUBARRAYVSIZE) / binning_v;
+    const DCAM_PIXELTYPE type =
+      (DCAM_PIXELTYPE)get(d, DCAM_IDPROP_IMAGE_PIXELTYPE);
+    const int32 rowbytes = bytes_of_row(type, width) + g.row_padding;
+    switch (id) {
+        case DCAM_IDPROP_IMAGE_WIDTH:
+            *out = width;
+            return 1;
+        case DCAM_IDPROP_IMAGE_HEIGHT:
+            *out = height;
+            return 1;
+        case DCAM_IDPROP_BUFFER_PIXELTYPE:
+            *out = type;
+            return 1;
+        case DCAM_IDPROP_BUFFER_ROWBYTES:
+            *out = rowbytes;
+            return 1;
+        case DCAM_IDPROP_BUFFER_FRAMEBYTES:
+            *out = (double)rowbytes * height;
+            return 1;
+        case DCAM_IDPROP_BUFFER_TOPOFFSETBYTES:
+            *out = 0;
+            return 1;
+        case DCAM_IDPROP_INTERNALFRAMEINTERVAL:
+            *out = get(d, DCAM_IDPROP_EXPOSURETIME);
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+uint16_t
+dcamstub_pixel(int32_t framestamp, int32_t x, int32_t y)
+{
+    return (uint16_t)(7 * framestamp + x + 3 * y);
+}
+
+static void
+write_frame(struct device* d)
+{
+    const int32 slot = d->frame_count % d->depth;
+    uint8_t* frame = d->frames[slot];
+    for (int32 y = 0; y < d->height; ++y) {
+        uint8_t* row = frame + (size_t)y * d->rowbytes;
+        for (int32 x = 0; x < d->width; ++x) {
+            const uint16_t v = dcamstub_pixel(d->framestamp, x, y);
+            switch (d->type) {
+                case DCAM_PIXELTYPE_MONO8:
+                    row[x] = (uint8_t)v;
+                    break;
+                case DCAM_PIXELTYPE_MONO12: // 12 bits in the low bits of 16
+                    ((uint16_t*)row)[x] = v & 0x0fff;
+                    break;
+                case DCAM_PIXELTYPE_MONO12P: {
+                    // Pairs of pixels in three bytes, low bits first.
+                    uint8_t* p = row + x / 2 * 3;
+                    if (x & 1) {
+                        p[1] = (uint8_t)((p[1] & 0x0f) | ((v & 0x0f) << 4));
+                        p[2] = (uint8_t)((v >> 4) & 0xff);
+                    } else {
+                        p[0] = (uint8_t)(v & 0xff);
+                        p[1] = (uint8_t)((p[1] & 0xf0) | ((v >> 8) & 0x0f));
+                    }
+                    break;
+                }
+                default:
+                    ((uint16_t*)row)[x] = v;
+            }
+        }
+    }
+    d->framestamps[slot] = d->framestamp++;
+    ++d->frame_count;
+}
+
+static int32
+to_slot(struct device* d, int32 iFrame)
+{
+    if (!d->frame_count)
+        return -1;
+    if (iFrame < 0)
+        return (d->frame_count - 1) % d->depth;
+    if (iFrame >= d->depth || iFrame >= d->frame_count)
+        return -1;
+    return iFrame;
+}
+
+static void
+describe_frame(struct device* d, int32 slot, DCAMBUF_FRAME* frame)
+{
+    const int32 stamp = d->framestamps[slot];
+    frame->iFrame = slot;
+    frame->type = d->type;
+    frame->width = d->width;
+    frame->height = d->height;
+    frame->left = 0;
+    frame->top = 0;
+    frame->framestamp = stamp;
+    frame->camerastamp = stamp;
+    frame->timestamp.sec = (_ui32)(stamp / 100);
+    frame->timestamp.microsec = (stamp % 100) * 10000;
+}
+
+//
+// Controls
+//
+
+void
+dcamstub_reset(void)
+{
+    for (int i = 0; i < countof(g.devices); ++i) {
+        free(g.devices[i].ring);
+        free(g.devices[i].frames);
+        free(g.devices[i].framestamps);
+    }
+    memset(&g, 0, sizeof(g));
+    g.device_count = 1;
+    g.frames_per_wait = 1;
+}
+
+void
+dcamstub_set_device_count(int32_t n)
+{
+    g.device_count = n < MAX_DEVICES ? n : MAX_DEVICES;
+}
+
+void
+dcamstub_set_row_padding(int32_t bytes)
+{
+    g.row_padding = bytes;
+}
+
+void
+dcamstub_set_frames_per_wait(int32_t n)
+{
+    g.frames_per_wait = n;
+}
+
+void
+dcamstub_set_mono12p_supported(int is_supported)
+{
+    g.is_mono12p_unsupported = !is_supported;
+}
+
+void
+dcamstub_lose_frames(int32_t n)
+{
+    g.frames_to_lose = n;
+}
+
+void
+dcamstub_fault_device(int32_t index)
+{
+    if (index >= 0 && index < MAX_DEVICES)
+        g.devices[index].is_faulted = 1;
+}
+
+void
+dcamstub_fail_init(int32_t n)
+{
+    g.init_failures = n;
+}
+
+void
+dcamstub_fail_open(int32_t n)
+{
+    g.open_failures = n;
+}
+
+void
+dcamstub_fail_getvalue(int32_t prop_id)
+{
+    g.unreadable_prop = prop_id;
+}
+
+const struct dcamstub_calls*
+dcamstub_get_calls(void)
+{
+    return &g.calls;
+}
+
+void
+dcamstub_clear_calls(void)
+{
+    memset(&g.calls, 0, sizeof(g.calls));
+}
+
+//
+// DCAM-API
+//
+
+DCAMERR DCAMAPI
+dcamapi_init(DCAMAPI_INIT* param)
+{
+    ++g.calls.init;
+    if (!param)
+        return DCAMERR_INVALIDPARAM;
+    if (g.init_failures > 0) {
+        --g.init_failures;
+        return DCAMERR_NOCAMERA;
+    }
+    g.is_initialized = 1;
+    param->iDeviceCount = g.device_count;
+    return g.device_count ? DCAMERR_SUCCESS : DCAMERR_NOCAMERA;
+}
+
+DCAMERR DCAMAPI
+dcamapi_uninit(void)
+{
+    g.is_initialized = 0;
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcamdev_open(DCAMDEV_OPEN* param)
+{
+    ++g.calls.open;
+    if (!g.is_initialized || !param || param->index < 0 ||
+        param->index >= g.device_count)
+        return DCAMERR_INVALIDPARAM;
+    if (g.open_failures > 0) {
+        --g.open_failures;
+        return DCAMERR_NOCAMERA;
+    }
+    struct device* d = g.devices + param->index;
+    d->is_open = 1;
+    d->is_faulted = 0;
+    d->index = param->index;
+    init_props(d);
+    param->hdcam = (HDCAM)d;
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcamdev_close(HDCAM h)
+{
+    struct device* d = as_device(h);
+    if (!d)
+        return DCAMERR_INVALIDHANDLE;
+    dcambuf_release(h, 0);
+    d->is_open = 0;
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcamdev_getstring(HDCAM h, DCAMDEV_STRING* param)
+{
+    ++g.calls.getstring;
+    // Before opening, DCAM accepts the device index in place of a handle.
+    int32 index = (int32)(size_t)h;
+    struct device* d = as_device(h);
+    if (d)
+        index = d->index;
+    if (!g.is_initialized || index < 0 || index >= g.device_count)
+        return DCAMERR_INVALIDPARAM;
+
+    switch (param->iString) {
+        case DCAM_IDSTR_MODEL:
+            snprintf(param->text, param->textbytes, "C15440-20UP");
+            return DCAMERR_SUCCESS;
+        case DCAM_IDSTR_CAMERAID:
+            snprintf(param->text, param->textbytes, "S/N: %06d", index + 1);
+            return DCAMERR_SUCCESS;
+        default:
+            return DCAMERR_INVALIDPARAM;
+    }
+}
+
+DCAMERR DCAMAPI
+dcamprop_getattr(HDCAM h, DCAMPROP_ATTR* param)
+{
+    struct device* d = as_device(h);
+    ++g.calls.getattr;
+    if (!d)
+        return DCAMERR_INVALIDHANDLE;
+    param->attribute = DCAMPROP_ATTR_READABLE | DCAMPROP_ATTR_WRITABLE;
+    param->iProp_ArrayBase = param->iProp;
+    param->iPropStep_Element = ARRAY_ELEMENT_STEP;
+    param->valuemin = 0.0;
+    param->valuemax = 1e6;
+    switch (param->iProp) {
+        case DCAM_IDPROP_SUBARRAYHSIZE:
+        case DCAM_IDPROP_SUBARRAYVSIZE:
+            param->valuemin = 4;
+            param->valuemax = SENSOR_PIXELS;
+            break;
+        case DCAM_IDPROP_SUBARRAYHPOS:
+        case DCAM_IDPROP_SUBARRAYVPOS:
+            param->valuemax = SENSOR_PIXELS - 4;
+            break;
+        case DCAM_IDPROP_BINNING:
+        case DCAM_IDPROP_BINNING_HORZ:
+            param->valuemin = 1;
+            param->valuemax = 4;
+            break;
+        case DCAM_IDPROP_BINNING_VERT:
+            param->valuemin = 1;
+            param->valuemax = 8;
+            break;
+        case DCAM_IDPROP_EXPOSURETIME:
+            param->valuemin = 1e-5;
+            param->valuemax = 10.0;
+            break;
+        case DCAM_IDPROP_INTERNAL_LINEINTERVAL:
+            param->valuemin = 1e-6;
+            param->valuemax = 1e-3;
+            break;
+        case DCAM_IDPROP_READOUT_DIRECTION:
+            param->valuemin = DCAMPROP_READOUT_DIRECTION__FORWARD;
+            param->valuemax = DCAMPROP_READOUT_DIRECTION__BACKWARD;
+            break;
+        default:;
+    }
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcamprop_getvalue(HDCAM h, int32 iProp, double* pValue)
+{
+    struct device* d = as_device(h);
+    ++g.calls.getvalue;
+    if (!d)
+        return DCAMERR_INVALIDHANDLE;
+    if (g.unreadable_prop && iProp == g.unreadable_prop)
+        return DCAMERR_NOTSUPPORT;
+    if (!get_derived(d, iProp, pValue))
+        *pValue = get(d, iProp);
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcamprop_setvalue(HDCAM h, int32 iProp, double fValue)
+{
+    struct device* d = as_device(h);
+    ++g.calls.setvalue;
+    if (!d)
+        return DCAMERR_INVALIDHANDLE;
+    // Like DCAM, timing and triggering can change during capture.
+    if (d->is_capturing && is_buffer_property(iProp))
+        return DCAMERR_BUSY;
+    if (d->frames && is_buffer_property(iProp))
+        return DCAMERR_NOTSTABLE;
+    if (iProp == DCAM_IDPROP_IMAGE_PIXELTYPE &&
+        (int32)fValue == DCAM_PIXELTYPE_MONO12P && g.is_mono12p_unsupported)
+        return DCAMERR_INVALIDVALUE;
+    if (!is_subarray_on_sensor(d, iProp, fValue))
+        return DCAMERR_INVALIDVALUE;
+    put(d, iProp, fValue);
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcamprop_setgetvalue(HDCAM h, int32 iProp, double* pValue, int32 option)
+{
+    DCAMERR ecode = dcamprop_setvalue(h, iProp, *pValue);
+    if ((int)ecode < 0)
+        return ecode;
+    return dcamprop_getvalue(h, iProp, pValue);
+}
+
+static DCAMERR
+init_ring(struct device* d, int32 framecount)
+{
+    double v;
+    d->type = (DCAM_PIXELTYPE)get(d, DCAM_IDPROP_IMAGE_PIXELTYPE);
+    get_derived(d, DCAM_IDPROP_IMAGE_WIDTH, &v);
+    d->width = (int32)v;
+    get_derived(d, DCAM_IDPROP_IMAGE_HEIGHT, &v);
+    d->height = (int32)v;
+    get_derived(d, DCAM_IDPROP_BUFFER_ROWBYTES, &v);
+    d->rowbytes = (int32)v;
+    d->framebytes = d->rowbytes * d->height;
+    d->depth = framecount;
+    d->frames = (uint8_t**)calloc(framecount, sizeof(uint8_t*));
+    d->framestamps = (int32*)calloc(framecount, sizeof(int32));
+    if (!d->frames || !d->framestamps)
+        return DCAMERR_NOMEMORY;
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcambuf_alloc(HDCAM h, int32 framecount)
+{
+    struct device* d = as_device(h);
+    ++g.calls.alloc;
+    if (!d)
+        return DCAMERR_INVALIDHANDLE;
+    if (d->frames || framecount <= 0)
+        return DCAMERR_INVALIDPARAM;
+    DCAMERR ecode = init_ring(d, framecount);
+    if (ecode != DCAMERR_SUCCESS)
+        return ecode;
+    d->ring = (uint8_t*)malloc((size_t)d->framebytes * framecount);
+    if (!d->ring)
+        return DCAMERR_NOMEMORY;
+    for (int32 i = 0; i < framecount; ++i)
+        d->frames[i] = d->ring + (size_t)i * d->framebytes;
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcambuf_attach(HDCAM h, const DCAMBUF_ATTACH* param)
+{
+    struct device* d = as_device(h);
+    ++g.calls.attach;
+    if (!d)
+        return DCAMERR_INVALIDHANDLE;
+    if (d->frames || param->iKind != DCAMBUF_ATTACHKIND_FRAME ||
+        param->buffercount <= 0 || !param->buffer)
+        return DCAMERR_INVALIDPARAM;
+    DCAMERR ecode = init_ring(d, param->buffercount);
+    if (ecode != DCAMERR_SUCCESS)
+        return ecode;
+    for (int32 i = 0; i < param->buffercount; ++i)
+        d->frames[i] = (uint8_t*)param->buffer[i];
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcambuf_release(HDCAM h, int32 iKind)
+{
+    struct device* d = as_device(h);
+    ++g.calls.release;
+    if (!d)
+        return DCAMERR_INVALIDHANDLE;
+    if (d->is_capturing)
+        return DCAMERR_BUSY;
+    free(d->ring);
+    free(d->frames);
+    free(d->framestamps);
+    d->ring = 0;
+    d->frames = 0;
+    d->framestamps = 0;
+    d->depth = 0;
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcambuf_lockframe(HDCAM h, DCAMBUF_FRAME* pFrame)
+{
+    struct device* d = as_device(h);
+    ++g.calls.lockframe;
+    if (!d)
+        return DCAMERR_INVALIDHANDLE;
+    const int32 slot = to_slot(d, pFrame->iFrame);
+    if (slot < 0)
+        return DCAMERR_INVALIDFRAMEINDEX;
+    describe_frame(d, slot, pFrame);
+    pFrame->buf = d->frames[slot];
+    pFrame->rowbytes = d->rowbytes;
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcambuf_copyframe(HDCAM h, DCAMBUF_FRAME* pFrame)
+{
+    struct device* d = as_device(h);
+    ++g.calls.copyframe;
+    if (!d)
+        return DCAMERR_INVALIDHANDLE;
+    const int32 slot = to_slot(d, pFrame->iFrame);
+    if (slot < 0 || !pFrame->buf)
+        return DCAMERR_INVALIDFRAMEINDEX;
+    const size_t row = (size_t)bytes_of_row(d->type, d->width);
+    if (pFrame->rowbytes < (int32)row)
+        return DCAMERR_INVALIDPARAM;
+    const uint8_t* src = d->frames[slot];
+    for (int32 y = 0; y < d->height; ++y) {
+        memcpy((uint8_t*)pFrame->buf + (size_t)y * pFrame->rowbytes,
+               src + (size_t)y * d->rowbytes,
+               row);
+    }
+    describe_frame(d, slot, pFrame);
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcamcap_start(HDCAM h, int32 mode)
+{
+    struct device* d = as_device(h);
+    if (!d)
+        return DCAMERR_INVALIDHANDLE;
+    if (!d->frames)
+        return DCAMERR_NOTREADY;
+    if (d->is_faulted)
+        return DCAMERR_NOCAMERA;
+    d->is_capturing = 1;
+    d->frame_count = 0;
+    d->framestamp = 0;
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcamcap_stop(HDCAM h)
+{
+    struct device* d = as_device(h);
+    if (!d)
+        return DCAMERR_INVALIDHANDLE;
+    d->is_capturing = 0;
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcamcap_status(HDCAM h, int32* pStatus)
+{
+    struct device* d = as_device(h);
+    if (!d)
+        return DCAMERR_INVALIDHANDLE;
+    *pStatus = d->is_capturing ? DCAMCAP_STATUS_BUSY
+               : d->frames     ? DCAMCAP_STATUS_READY
+                               : DCAMCAP_STATUS_STABLE;
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcamcap_transferinfo(HDCAM h, DCAMCAP_TRANSFERINFO* param)
+{
+    struct device* d = as_device(h);
+    ++g.calls.transferinfo;
+    if (!d)
+        return DCAMERR_INVALIDHANDLE;
+    param->nFrameCount = d->frame_count;
+    param->nNewestFrameIndex =
+      d->frame_count ? (d->frame_count - 1) % d->depth : -1;
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcamcap_firetrigger(HDCAM h, int32 iKind)
+{
+    struct device* d = as_device(h);
+    ++g.calls.firetrigger;
+    if (!d)
+        return DCAMERR_INVALIDHANDLE;
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcamwait_open(DCAMWAIT_OPEN* param)
+{
+    if (!as_device(param->hdcam))
+        return DCAMERR_INVALIDHANDLE;
+    param->hwait = (HDCAMWAIT)param->hdcam;
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcamwait_close(HDCAMWAIT hWait)
+{
+    return DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcamwait_start(HDCAMWAIT hWait, DCAMWAIT_START* param)
+{
+    struct device* d = as_device((HDCAM)hWait);
+    ++g.calls.wait;
+    if (!d)
+        return DCAMERR_INVALIDWAITHANDLE;
+    // Nothing else could wake the wait, so report a timeout instead of
+    // blocking forever.
+    if (!d->is_capturing)
+        return DCAMERR_TIMEOUT;
+    const int32 lost = g.frames_to_lose;
+    // Nothing arrives before the timeout.
+    if (g.frames_per_wait <= 0 && !lost)
+        return DCAMERR_TIMEOUT;
+    g.frames_to_lose = 0;
+    d->framestamp += lost;
+    for (int32 i = 0; i < g.frames_per_wait; ++i)
+        write_frame(d);
+    param->eventhappened = DCAMWAIT_CAPEVENT_FRAMEREADY;
+    return lost ? DCAMERR_LOSTFRAME : DCAMERR_SUCCESS;
+}
+
+DCAMERR DCAMAPI
+dcamwait_abort(HDCAMWAIT hWait)
+{
+    // Waits never block, so there is nothing to abort.
+    return DCAMERR_SUCCESS;
+}
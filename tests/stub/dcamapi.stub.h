@@ -0,0 +1,70 @@
+#ifndef H_ACQUIRE_DRIVER_HDCAM_DCAMAPI_STUB_V0
+#define H_ACQUIRE_DRIVER_HDCAM_DCAMAPI_STUB_V0
+
+#include <stddef.h> // must come before dcamapi4.h
+#include <stdint.h>
+#include <dcamapi4.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /// @brief Counts of calls made into the stub DCAM library.
+    struct dcamstub_calls
+    {
+        uint64_t getvalue, setvalue, getattr;
+        uint64_t copyframe, lockframe, transferinfo;
+        uint64_t wait, firetrigger;
+        uint64_t alloc, attach, release;
+        uint64_t init, open, getstring;
+    };
+
+    /// @brief Restore the stub to its initial state.
+    /// @details Closes all devices, clears call counts and restores the
+    ///          default device count, row padding and frame rate.
+    void dcamstub_reset(void);
+
+    /// @brief Number of devices reported by dcamapi_init().
+    void dcamstub_set_device_count(int32_t n);
+
+    /// @brief Extra bytes added to the end of every row in the capture ring.
+    void dcamstub_set_row_padding(int32_t bytes);
+
+    /// @brief Number of frames written to the ring on each dcamwait_start().
+    /// @details With 0, waits report DCAMERR_TIMEOUT.
+    void dcamstub_set_frames_per_wait(int32_t n);
+
+    /// @brief Whether the camera accepts DCAM_PIXELTYPE_MONO12P.
+    void dcamstub_set_mono12p_supported(int is_supported);
+
+    /// @brief The camera produces `n` frames that never reach the ring before
+    ///        the next dcamwait_start(), which then reports
+    ///        DCAMERR_LOSTFRAME.
+    void dcamstub_lose_frames(int32_t n);
+
+    /// @brief Device `index` fails to start capturing until it's closed and
+    ///        opened again.
+    void dcamstub_fault_device(int32_t index);
+
+    /// @brief The next `n` calls to dcamapi_init() fail.
+    void dcamstub_fail_init(int32_t n);
+
+    /// @brief The next `n` calls to dcamdev_open() fail.
+    void dcamstub_fail_open(int32_t n);
+
+    /// @brief dcamprop_getvalue() fails for `prop_id`. With 0, every
+    ///        property can be read.
+    void dcamstub_fail_getvalue(int32_t prop_id);
+
+    /// @brief Expected value of pixel (x,y) for the frame with `framestamp`.
+    uint16_t dcamstub_pixel(int32_t framestamp, int32_t x, int32_t y);
+
+    const struct dcamstub_calls* dcamstub_get_calls(void);
+    void dcamstub_clear_calls(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // H_ACQUIRE_DRIVER_HDCAM_DCAMAPI_STUB_V0
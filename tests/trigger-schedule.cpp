@@ -0,0 +1,155 @@
+/// The driver fires software triggers on a schedule while capture runs, and
+/// records when each one was fired.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+#include "platform.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+static void
+set_frame_start_trigger(struct Camera* camera, uint8_t line)
+{
+    CameraProperties props = {};
+    DEVOK(camera->get(camera, &props));
+    props.input_triggers.frame_start.enable = 1;
+    props.input_triggers.frame_start.line = line;
+    props.input_triggers.frame_start.kind = Signal_Input;
+    DEVOK(camera->set(camera, &props));
+}
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        const uint8_t line_software = 4;
+        dcamstub_reset();
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+        set_frame_start_trigger(camera, line_software);
+
+        // At a fixed rate.
+        {
+            Dcam4TriggerSchedule schedule = {};
+            schedule.period_ms = 5.0;
+            DEVOK(aq_dcam_set_trigger_schedule(camera, &schedule));
+            dcamstub_clear_calls();
+            DEVOK(camera->start(camera));
+            CHECK(Device_Err ==
+                  aq_dcam_set_trigger_schedule(camera, &schedule));
+            clock_sleep_ms(0, 100.0);
+            DEVOK(camera->stop(camera));
+
+            Dcam4Status status = {};
+            DEVOK(aq_dcam_get_status(camera, &status));
+            EXPECT(status.triggers.fired >= 10 && status.triggers.fired <= 30,
+                   "Expected about 20 triggers. Got %d.",
+                   (int)status.triggers.fired);
+            CHECK(status.triggers.failed == 0);
+            CHECK(dcamstub_get_calls()->firetrigger == status.triggers.fired);
+
+            for (uint64_t i = 0; i < status.triggers.fired; ++i) {
+                double fired_ms = 0.0;
+                DEVOK(aq_dcam_get_trigger_time(camera, i, &fired_ms));
+                EXPECT(fired_ms >= 5.0 * i,
+                       "Trigger %d fired early, at %f ms.",
+                       (int)i,
+                       fired_ms);
+            }
+            double fired_ms = 0.0;
+            CHECK(Device_Err == aq_dcam_get_trigger_time(
+                                  camera, status.triggers.fired, &fired_ms));
+            LOG("Latest trigger was %f ms late.", status.triggers.max_late_ms);
+        }
+
+        // At given times.
+        {
+            const double times_ms[] = { 0.0, 3.0, 4.0, 20.0 };
+            Dcam4TriggerSchedule schedule = {};
+            schedule.times_ms = times_ms;
+            schedule.count = 4;
+            DEVOK(aq_dcam_set_trigger_schedule(camera, &schedule));
+            DEVOK(camera->start(camera));
+            clock_sleep_ms(0, 50.0);
+            DEVOK(camera->stop(camera));
+
+            Dcam4Status status = {};
+            DEVOK(aq_dcam_get_status(camera, &status));
+            CHECK(status.triggers.fired == 4);
+            for (uint64_t i = 0; i < 4; ++i) {
+                double fired_ms = 0.0;
+                DEVOK(aq_dcam_get_trigger_time(camera, i, &fired_ms));
+                CHECK(fired_ms >= times_ms[i]);
+            }
+
+            const double unordered_ms[] = { 1.0, 0.0 };
+            schedule.times_ms = unordered_ms;
+            schedule.count = 2;
+            CHECK(Device_Err ==
+                  aq_dcam_set_trigger_schedule(camera, &schedule));
+        }
+
+        // Not with an external trigger.
+        {
+            set_frame_start_trigger(camera, 0);
+            dcamstub_clear_calls();
+            DEVOK(camera->start(camera));
+            clock_sleep_ms(0, 20.0);
+            DEVOK(camera->stop(camera));
+            Dcam4Status status = {};
+            DEVOK(aq_dcam_get_status(camera, &status));
+            CHECK(status.triggers.fired == 0);
+            CHECK(dcamstub_get_calls()->firetrigger == 0);
+        }
+
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
@@ -0,0 +1,205 @@
+/// SampleType_u8 frames can be converted by the driver from 16-bit pixels,
+/// with a shift or a black/white window, instead of coming from the camera
+/// as 8-bit pixels.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+#include "dcam.copy.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+static uint8_t
+shift_one(uint16_t v, uint8_t shift)
+{
+    const unsigned y = (unsigned)v >> shift;
+    return (uint8_t)(y < 255 ? y : 255);
+}
+
+static uint8_t
+window_one(uint16_t v, uint16_t black, uint16_t white)
+{
+    const unsigned range = white - black;
+    unsigned d = v > black ? v - black : 0;
+    d = d < range ? d : range;
+    return (uint8_t)(int)((float)d * (255.0f / (float)range) + 0.5f);
+}
+
+/// Compares the conversion kernels with a pixel-at-a-time reference.
+static void
+check_kernels()
+{
+    const size_t height = 3;
+    for (size_t width = 1; width <= 100; ++width) {
+        const size_t pitch = 2 * width + 6;
+        std::vector<uint8_t> src(pitch * height);
+        for (size_t y = 0; y < height; ++y)
+            for (size_t x = 0; x < width; ++x)
+                ((uint16_t*)(src.data() + y * pitch))[x] =
+                  (uint16_t)((x * 40503u + y * 977u) & 0xffff);
+        auto at = [&](size_t x, size_t y) {
+            return ((const uint16_t*)(src.data() + y * pitch))[x];
+        };
+
+        std::vector<uint8_t> dst(width * height + 1, 0xcd);
+        for (uint8_t shift : { 0, 4, 8 }) {
+            shift_u16_to_u8_rows(
+              dst.data(), src.data(), width, pitch, height, shift);
+            for (size_t y = 0; y < height; ++y)
+                for (size_t x = 0; x < width; ++x)
+                    EXPECT(dst[y * width + x] == shift_one(at(x, y), shift),
+                           "Width %d shift %d: pixel (%d,%d) differs.",
+                           (int)width,
+                           shift,
+                           (int)x,
+                           (int)y);
+            CHECK(dst.back() == 0xcd);
+        }
+
+        const uint16_t windows[][2] = { { 0, 65535 }, { 1000, 5000 }, { 7, 8 } };
+        for (const auto& w : windows) {
+            window_u16_to_u8_rows(
+              dst.data(), src.data(), width, pitch, height, w[0], w[1]);
+            for (size_t y = 0; y < height; ++y)
+                for (size_t x = 0; x < width; ++x)
+                    EXPECT(dst[y * width + x] ==
+                             window_one(at(x, y), w[0], w[1]),
+                           "Width %d window [%d,%d]: pixel (%d,%d) differs.",
+                           (int)width,
+                           w[0],
+                           w[1],
+                           (int)x,
+                           (int)y);
+            CHECK(dst.back() == 0xcd);
+        }
+    }
+}
+
+/// Grabs a frame as u8 and checks each pixel with `expected`.
+template<typename F>
+static void
+check_frame(struct Camera* camera, uint32_t width, uint32_t height, F expected)
+{
+    ImageShape shape = {};
+    DEVOK(camera->get_shape(camera, &shape));
+    CHECK(shape.type == SampleType_u8);
+    CHECK(shape.dims.width == width);
+
+    DEVOK(camera->start(camera));
+    std::vector<uint8_t> im((size_t)width * height + 1, 0xcd);
+    size_t nbytes = 0;
+    ImageInfo info = {};
+    DEVOK(camera->get_frame(camera, im.data(), &nbytes, &info));
+    CHECK(nbytes == (size_t)width * height);
+    CHECK(im.back() == 0xcd);
+    const auto stamp = (int32_t)info.hardware_frame_id;
+    for (uint32_t y = 0; y < height; ++y) {
+        for (uint32_t x = 0; x < width; ++x) {
+            const uint16_t v = dcamstub_pixel(stamp, x, y);
+            EXPECT(im[(size_t)y * width + x] == expected(v),
+                   "Unexpected value at (%d,%d)",
+                   x,
+                   y);
+        }
+    }
+    DEVOK(camera->stop(camera));
+}
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        check_kernels();
+
+        dcamstub_reset();
+        dcamstub_set_row_padding(24);
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+
+        const uint32_t width = 200, height = 40;
+        Dcam4Options options = {};
+        DEVOK(aq_dcam_get_options(camera, &options));
+        options.u8_source = Dcam4U8Source_Window;
+        options.u8_black = 100;
+        options.u8_white = 400;
+        DEVOK(aq_dcam_set_options(camera, &options));
+
+        CameraProperties props = {};
+        DEVOK(camera->get(camera, &props));
+        props.pixel_type = SampleType_u8;
+        props.shape = { .x = width, .y = height };
+        DEVOK(camera->set(camera, &props));
+        DEVOK(camera->get(camera, &props));
+        CHECK(props.pixel_type == SampleType_u8);
+
+        check_frame(camera, width, height, [](uint16_t v) {
+            return window_one(v, 100, 400);
+        });
+
+        // The mapping may change without setting the pixel type again.
+        options.u8_source = Dcam4U8Source_Shift;
+        options.u8_shift = 2;
+        DEVOK(aq_dcam_set_options(camera, &options));
+        check_frame(
+          camera, width, height, [](uint16_t v) { return shift_one(v, 2); });
+
+        // Back to 8-bit pixels from the camera.
+        options.u8_source = Dcam4U8Source_Camera;
+        DEVOK(aq_dcam_set_options(camera, &options));
+        DEVOK(camera->set(camera, &props));
+        check_frame(
+          camera, width, height, [](uint16_t v) { return (uint8_t)v; });
+
+        // Bad windows are rejected.
+        options.u8_black = options.u8_white;
+        CHECK(Device_Err == aq_dcam_set_options(camera, &options));
+
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}
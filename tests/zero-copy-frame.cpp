@@ -0,0 +1,139 @@
+/// Frames locked in the DCAM ring should be readable in place, honoring the
+/// ring's row pitch, and hand the slot back on unlock.
+///
+/// Runs against the stub DCAM library.
+
+#include "dcam.camera.h"
+#include "stub/dcamapi.stub.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+
+int
+main()
+{
+    struct Driver* driver = 0;
+    try {
+        const int32_t padding = 24;
+        dcamstub_reset();
+        dcamstub_set_row_padding(padding);
+
+        CHECK(driver = acquire_driver_init_v0(reporter));
+        struct Device* device = 0;
+        DEVOK(driver->open(driver, 0, &device));
+        auto camera = (struct Camera*)device;
+
+        CameraProperties props = {};
+        DEVOK(camera->get(camera, &props));
+        props.pixel_type = SampleType_u16;
+        props.shape = { .x = 64, .y = 48 };
+        DEVOK(camera->set(camera, &props));
+
+        DEVOK(camera->start(camera));
+        for (int i = 0; i < 3; ++i) {
+            Dcam4Frame frame = {};
+            dcamstub_clear_calls();
+            DEVOK(aq_dcam_lock_frame(camera, &frame));
+            CHECK(frame.data);
+            // The frame geometry was captured when the acquisition started.
+            CHECK(dcamstub_get_calls()->getvalue == 0);
+            CHECK(frame.info.shape.dims.width == 64);
+            CHECK(frame.info.shape.dims.height == 48);
+            EXPECT(frame.pitch == 64 * 2 + padding,
+                   "Expected pitch %d. Got %d.",
+                   64 * 2 + padding,
+                   frame.pitch);
+
+            const auto stamp = (int32_t)frame.info.hardware_frame_id;
+            for (int32_t y = 0; y < 48; ++y) {
+                const auto row =
+                  (const uint16_t*)((const uint8_t*)frame.data +
+                                    (size_t)y * frame.pitch);
+                for (int32_t x = 0; x < 64; ++x) {
+                    EXPECT(row[x] == dcamstub_pixel(stamp, x, y),
+                           "Frame %d: unexpected value at (%d,%d)",
+                           stamp,
+                           x,
+                           y);
+                }
+            }
+
+            // Only one frame can be held at a time. Asking for another fails
+            // without waiting for one to arrive.
+            Dcam4Frame other = {};
+            const uint64_t waits = dcamstub_get_calls()->wait;
+            CHECK(Device_Err == aq_dcam_lock_frame(camera, &other));
+            CHECK(dcamstub_get_calls()->wait == waits);
+
+            DEVOK(aq_dcam_unlock_frame(camera, &frame));
+            CHECK(frame.data == 0);
+            CHECK(Device_Err == aq_dcam_unlock_frame(camera, &frame));
+        }
+
+        // Holding a frame while the ring wraps around is reported on unlock.
+        {
+            Dcam4Frame frame = {};
+            DEVOK(aq_dcam_lock_frame(camera, &frame));
+            dcamstub_set_frames_per_wait(100);
+            {
+                std::vector<uint8_t> im((size_t)frame.pitch * 48);
+                size_t nbytes = 0;
+                ImageInfo info = {};
+                DEVOK(camera->get_frame(camera, im.data(), &nbytes, &info));
+            }
+            CHECK(Device_Err == aq_dcam_unlock_frame(camera, &frame));
+            dcamstub_set_frames_per_wait(1);
+        }
+
+        // The slot is released even when the overwrite is reported.
+        {
+            Dcam4Frame frame = {};
+            DEVOK(aq_dcam_lock_frame(camera, &frame));
+            DEVOK(aq_dcam_unlock_frame(camera, &frame));
+        }
+
+        DEVOK(camera->stop(camera));
+        DEVOK(driver->close(driver, device));
+        DEVOK(driver->shutdown(driver));
+        LOG("DONE (OK)");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    return 1;
+}